@@ -0,0 +1,29 @@
+/* Name: eeprom.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* EEMEM variables are ordinary variables on the host, so the EEPROM
+ * functions just copy memory. Writes complete at once.
+ */
+
+#ifndef __host_eeprom_h_included__
+#define __host_eeprom_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_is_ready()                   1
+#define eeprom_busy_wait()
+#define eeprom_read_byte(addr)              (*(const uint8_t *)(addr))
+#define eeprom_write_byte(addr, value)      (*(uint8_t *)(addr) = (value))
+#define eeprom_update_byte(addr, value)     (*(uint8_t *)(addr) = (value))
+#define eeprom_read_block(dst, src, n)      memcpy((dst), (src), (n))
+#define eeprom_write_block(src, dst, n)     memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n)    memcpy((dst), (src), (n))
+
+#endif /* __host_eeprom_h_included__ */
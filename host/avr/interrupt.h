@@ -0,0 +1,20 @@
+/* Name: interrupt.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* The host build has no interrupts. host/mock.c sets the GPIOR0 flags that
+ * midifoot.c's interrupt handlers would set, at the simulated time the
+ * interrupt would fire.
+ */
+
+#ifndef __host_interrupt_h_included__
+#define __host_interrupt_h_included__
+
+#define sei()
+#define cli()
+#define ISR(vector, ...)    void vector(void)
+
+#endif /* __host_interrupt_h_included__ */
@@ -0,0 +1,105 @@
+/* Name: io.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Stand-in for avr-libc's <avr/io.h> in the host build. The ATtiny85 I/O
+ * registers used by midifoot.c and usbdrv.h are plain variables, defined in
+ * host/mock.c, which updates the timers and input pins as simulated time goes
+ * by. Only the names the firmware uses are here.
+ */
+
+#ifndef __host_io_h_included__
+#define __host_io_h_included__
+
+#include <stdint.h>
+
+#define HOST_REG(name)  extern volatile uint8_t name;
+HOST_REG(PINB) HOST_REG(PORTB) HOST_REG(DDRB) HOST_REG(MCUSR) HOST_REG(SREG)
+HOST_REG(TCCR0A) HOST_REG(TCCR0B) HOST_REG(TCNT0) HOST_REG(OCR0A) HOST_REG(OCR0B)
+HOST_REG(TCCR1) HOST_REG(TCNT1) HOST_REG(OCR1A) HOST_REG(OCR1B) HOST_REG(OCR1C)
+HOST_REG(GTCCR) HOST_REG(TIMSK) HOST_REG(TIFR) HOST_REG(GIMSK) HOST_REG(GIFR)
+HOST_REG(PCMSK) HOST_REG(MCUCR) HOST_REG(ACSR) HOST_REG(PRR) HOST_REG(GPIOR0)
+HOST_REG(GPIOR1) HOST_REG(GPIOR2) HOST_REG(OSCCAL)
+#undef HOST_REG
+
+/* RAM for MIDIFOOT_MEMORY_STATS, an image of the chip's with the static data
+ * ending at hostRamEnd, see host/mock.c */
+#define RAMSTART    0x60
+#define RAMEND      0x25f
+extern uint8_t hostRam[RAMEND + 1 - RAMSTART];
+extern uint16_t hostRamEnd;
+
+#define _SFR_IO_ADDR(reg)   0
+#define _BV(bit)            (1 << (bit))
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+/* TCCR0A, TCCR0B */
+#define COM0A1  7
+#define COM0A0  6
+#define COM0B1  5
+#define COM0B0  4
+#define WGM01   1
+#define WGM00   0
+#define WGM02   3
+#define CS02    2
+#define CS01    1
+#define CS00    0
+/* TCCR1, GTCCR */
+#define CTC1    7
+#define PWM1A   6
+#define COM1A1  5
+#define COM1A0  4
+#define CS13    3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+#define PWM1B   6
+#define COM1B1  5
+#define COM1B0  4
+/* TIMSK, TIFR */
+#define OCIE1A  6
+#define OCIE1B  5
+#define OCIE0A  4
+#define OCIE0B  3
+#define TOIE1   2
+#define TOIE0   1
+#define OCF1A   6
+#define OCF1B   5
+#define OCF0A   4
+#define OCF0B   3
+#define TOV1    2
+#define TOV0    1
+/* GIMSK, GIFR, PCMSK, MCUCR */
+#define INT0    6
+#define PCIE    5
+#define INTF0   6
+#define PCIF    5
+#define PCINT0  0
+#define PCINT1  1
+#define PCINT2  2
+#define PCINT3  3
+#define PCINT4  4
+#define PCINT5  5
+#define ISC01   1
+#define ISC00   0
+/* MCUSR */
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+/* ACSR, PRR */
+#define ACD     7
+#define PRTIM1  3
+#define PRTIM0  2
+#define PRUSI   1
+#define PRADC   0
+
+#endif /* __host_io_h_included__ */
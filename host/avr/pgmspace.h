@@ -0,0 +1,20 @@
+/* Name: pgmspace.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#ifndef __host_pgmspace_h_included__
+#define __host_pgmspace_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)             (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define memcpy_P            memcpy
+
+#endif /* __host_pgmspace_h_included__ */
@@ -0,0 +1,17 @@
+/* Name: power.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#ifndef __host_power_h_included__
+#define __host_power_h_included__
+
+#define power_adc_disable()
+#define power_usi_disable()
+#define power_timer0_disable()
+#define power_timer1_disable()
+#define power_all_disable()
+
+#endif /* __host_power_h_included__ */
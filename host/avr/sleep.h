@@ -0,0 +1,30 @@
+/* Name: sleep.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* sleep_cpu() lets simulated time pass until the next event that would
+ * wake the chip in the selected mode, see hostSleep() in mock.c.
+ */
+
+#ifndef __host_sleep_h_included__
+#define __host_sleep_h_included__
+
+#include <stdint.h>
+
+#define SLEEP_MODE_IDLE         0
+#define SLEEP_MODE_ADC          1
+#define SLEEP_MODE_PWR_DOWN     2
+
+extern uint8_t hostSleepMode;
+extern void hostSleep(void);
+
+#define set_sleep_mode(mode)    (hostSleepMode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()             hostSleep()
+#define sleep_bod_disable()
+
+#endif /* __host_sleep_h_included__ */
@@ -0,0 +1,817 @@
+/* Name: hostsim.c
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Runs the firmware in midifoot.c on the host, against the mocked V-USB
+ * driver and simulated ATtiny85 registers in host/mock.c, and feeds it random
+ * button presses with contact bounce.
+ *
+ * Every press and release settles after its bounce, so each one must come
+ * out as exactly one MIDI event (or be counted as dropped by the health
+ * counters). This is checked unless the firmware classifies gestures,
+ * which -g plays from a script instead.
+ *
+ * Build and run with "make host", see the Makefile for the options.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "midifootconfig.h"
+#include "requests.h"
+#include "patterns.h"
+#include "mock.h"
+
+extern int firmwareMain(void);  // main() of midifoot.c, renamed by the Makefile
+
+uint64_t nextEdge = NEVER;      // next change on PB0
+
+/* ----------------------------- Button input ------------------------------ */
+
+int verbose = 0;
+long waveforms = 1000000;       // press and release pairs to send
+double holdMax = 20;            // ms, pressed and released times are random
+double holdMin = 1;             // up to these, longer than the debounce
+int bounceMax = 6;              // bounces per edge
+// Bounces last 20-150 us, below the 200 us debounce time. The main loop polls
+// PB0, so two edges within one loop pass (about 13 us) go unseen. If more
+// such glitches follow, the debounce can settle on the wrong level.
+#define BOUNCE_MIN_US 20
+#define BOUNCE_MAX_US 150
+uint64_t rng = 0x9e3779b97f4a7c15ULL;
+
+long groups = 0;                // presses and releases started
+int groupEdges;                 // edges left in the current one
+uint64_t lastEdge;
+
+// first edge of every press or release not sent yet, to measure latency
+#define PENDING_LEN 64
+uint64_t pending[PENDING_LEN];
+uint8_t pendingHead, pendingTail;
+
+// -m: play the MIDI messages out in real time, e.g. into an ALSA virtual
+// rawmidi port for tools/mflatency, and -T: tell when each press started
+int midiFd = -1;
+FILE *pressFile;
+uint64_t wallStart;             // CLOCK_MONOTONIC ns at simulated time 0
+
+uint64_t wallNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t wallAt(uint64_t cycles)
+{
+    return wallStart + (uint64_t)(cycles * (1e9 / F_CPU));
+}
+
+// keep simulated time from running ahead of the clock
+void realtimeWait(uint64_t cycles)
+{
+    if (midiFd < 0) return;
+    uint64_t t = wallAt(cycles);
+    if (t < wallNow() + 100000) return;
+    struct timespec ts = {t / 1000000000ULL, t % 1000000000ULL};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+long events = 0;                // MIDI events the host received
+long expected = 0;
+uint64_t latencyMin = NEVER, latencyMax = 0, latencySum = 0;
+long latencyCount = 0;
+
+uint64_t randomNext(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+double randomRange(double lo, double hi)
+{
+    return lo + (hi - lo) * (randomNext() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* ---------------------------- Gesture script ----------------------------- */
+
+#if MIDIFOOT_GESTURES
+// -g: instead of random presses, play gestures that end 5 ms inside or
+// outside of each window and check the control changes they send, as
+// controller:value. The windows are counted in 1.024 ms ticks from the
+// debounced change, which the bounces move by up to 2 ms. The banks carry
+// on from one gesture to the next, so their values follow on too. With
+// MIDIFOOT_SPECULATIVE_TAP the first tap of a double tap goes out on its
+// release, and the second press reverts it (the tap bank's previous value)
+// before the double tap message.
+#define SCRIPT_IDLE_MS 1000     // between gestures, all windows closed
+
+typedef struct
+{
+    const char *name;
+    double ms[8];               // pressed, released, pressed, ... until 0
+    const char *expect;
+    const char *speculative;    // expected with MIDIFOOT_SPECULATIVE_TAP
+} gesture_t;
+
+const gesture_t script[] = {
+    {"tap", {50}, "64:70", "64:70"},
+    {"two taps just outside the double tap window", {50, 256, 50},
+        "64:0 64:100", "64:0 64:100"},
+    {"double tap just inside the window", {50, 245, 50},
+        "65:127", "64:30 64:100 65:127"},
+    {"tap just short of a long press", {595}, "64:30", "64:30"},
+    {"long press", {605}, "66:127", "66:127"},
+    {"long press just short of a hold", {1195}, "66:0", "66:0"},
+    {"hold", {1205}, "66:127 67:127", "66:127 67:127"},
+    {"hold just past a repeat", {1405}, "66:0 67:127 67:127", "66:0 67:127 67:127"},
+    {"double tap held on", {50, 100, 1500}, "65:0", "64:85 64:30 65:0"},
+    {"triple tap", {50, 100, 50, 100, 50},
+        "65:127 64:85", "64:85 64:30 65:127 64:85"},
+    {"tap, then a long press after the window", {50, 256, 605},
+        "64:15 66:127", "64:15 66:127"},
+};
+#define SCRIPT_LEN (int)(sizeof(script) / sizeof(script[0]))
+
+int scripted = 0;
+int scriptCase = -1, scriptEdge;    // gesture being played, its next ms[]
+int scriptStart = 0;                // the next edge starts a gesture
+char scriptGot[64];                 // control changes since it started
+int scriptFailed = 0;
+
+void scriptReceived(const uchar *pkt)
+{
+    size_t len = strlen(scriptGot);
+    snprintf(scriptGot + len, sizeof(scriptGot) - len, "%s%d:%d",
+        len ? " " : "", pkt[2], pkt[3]);
+}
+
+void scriptCheck(int i)
+{
+    const char *expect = MIDIFOOT_SPECULATIVE_TAP ? script[i].speculative : script[i].expect;
+    int failed = strcmp(scriptGot, expect) != 0;
+    if (failed) printf("FAIL: %s sent \"%s\", not \"%s\"\n", script[i].name, scriptGot, expect);
+    else if (verbose) printf("%s: %s\n", script[i].name, scriptGot);
+    scriptFailed += failed;
+    scriptGot[0] = 0;
+}
+
+// ms to the next press or release, 0 at the end of the script
+double scriptNext(void)
+{
+    if (scriptCase >= 0 && scriptEdge < 8 && script[scriptCase].ms[scriptEdge])
+    {
+        return script[scriptCase].ms[scriptEdge++];
+    }
+    if (++scriptCase == SCRIPT_LEN) return 0;
+    scriptEdge = 0;
+    scriptStart = 1;
+    return SCRIPT_IDLE_MS;
+}
+#endif
+
+void edgeNext(void)
+{
+    if (groupEdges)
+    {
+        nextEdge = now + US(randomRange(BOUNCE_MIN_US, BOUNCE_MAX_US));
+        return;
+    }
+#if MIDIFOOT_GESTURES
+    if (scripted)
+    {
+        double ms = scriptNext();
+        if (!ms)
+        {
+            nextEdge = NEVER;
+            return;
+        }
+        nextEdge = now + US(ms * 1000);
+        groupEdges = 1 + 2 * (randomNext() % (bounceMax + 1));
+        groups++;
+        expected++;
+        return;
+    }
+#endif
+    if (groups == 2 * waveforms)
+    {
+        nextEdge = NEVER;
+        return;
+    }
+    nextEdge = now + US(randomRange(holdMin, holdMax) * 1000);
+    groupEdges = 1 + 2 * (randomNext() % (bounceMax + 1));
+    groups++;
+    expected++;
+    pending[pendingHead++ % PENDING_LEN] = nextEdge;
+    if (pressFile)
+    {
+        fprintf(pressFile, "%llu\n", (unsigned long long)wallAt(nextEdge));
+        fflush(pressFile);
+    }
+}
+
+void edge(void)
+{
+#if MIDIFOOT_GESTURES
+    if (scriptStart && scriptCase) scriptCheck(scriptCase - 1);
+    scriptStart = 0;
+#endif
+    PINB ^= 1 << PB0;
+    vcdChange(VCD_PB0, now, (PINB >> PB0) & 1);
+    GPIOR0 |= 1 << FLAG_BUS;    // pin change interrupt
+    groupEdges--;
+    lastEdge = now;
+    edgeNext();
+}
+
+/* ------------------------------ Virtual host ----------------------------- */
+
+void packetReceived(void)
+{
+    for (uint8_t i = 0; i < txLen; i += 4)
+    {
+        if (verbose)
+        {
+            printf("%12.3f ms  %02x %02x %02x %02x\n", now / (F_CPU / 1000.0),
+                txData[i], txData[i + 1], txData[i + 2], txData[i + 3]);
+        }
+        events++;
+#if MIDIFOOT_GESTURES
+        if (scripted) scriptReceived(txData + i);
+#endif
+        if (midiFd >= 0 && write(midiFd, txData + i + 1, 3) != 3)
+        {
+            perror("midi output");
+            midiFd = -1;
+        }
+        if (MIDIFOOT_GESTURES || pendingTail == pendingHead) continue;
+        uint64_t t = now - pending[pendingTail++ % PENDING_LEN];
+        if (t < latencyMin) latencyMin = t;
+        if (t > latencyMax) latencyMax = t;
+        latencySum += t;
+        latencyCount++;
+    }
+}
+
+/* ----------------------------- DIN receiver ------------------------------ */
+
+#if MIDIFOOT_DIN_OUT
+// The firmware's timer0 compare A interrupt runs at every match while it is
+// enabled. A match during a USB transaction waits for the driver's interrupt
+// to end (busyUntil), and only one can wait: if the next match has passed by
+// then, it comes around again after 256 counts, like on the chip.
+//
+// Two receivers read the pin. The first takes the level each interrupt
+// writes, which is what the firmware meant to send, and counts the messages.
+// The second is the UART of a MIDI interface: it starts on the falling edge
+// of a start bit and samples the middle of each bit from there. Every byte
+// it gets wrong, or misses, corrupts the message the byte belongs to.
+#define BIT_CYCLES (F_CPU / 31250)
+void dinInterrupt(void);        // in midifoot.c
+
+long dinEvents = 0, dinThru = 0, dinFraming = 0;
+int dinBit = -1;                // data bit being received, -1 between bytes
+uint8_t dinByte;
+uint8_t dinData, dinNeed;       // data bytes of the message, running status
+uint8_t dinRunning, dinFirst;   // and its status and first data byte
+uint8_t dinWaiting = 0;         // a match waits for the driver's interrupt
+uint64_t dinByteStart;
+
+// bytes the first receiver got, until the UART has them too
+#define SENT_LEN 64
+struct
+{
+    uint64_t start;
+    long msg;                   // number of the message it belongs to
+    uint8_t value;
+} sent[SENT_LEN];
+uint8_t sentHead, sentTail;
+
+long uartBytes = 0, uartCorrupted = 0, uartLast = -1;
+int uartBit = -1;               // bit being sampled, -1 waiting for a start bit
+uint8_t uartByte, uartLevel = 1;
+uint64_t uartStart, uartNext = NEVER;
+
+uint64_t dinMatch(void)
+{
+    if (!(TIMSK & (1 << OCIE0A))) return NEVER;
+    uint64_t count = now >> 6;
+    uint8_t ahead = OCR0A - (uint8_t)count;
+    return (count + (ahead ? ahead : 256)) << 6;
+}
+
+void dinReceive(void)
+{
+    uint8_t level = (PORTB >> MIDIFOOT_DIN_PIN) & 1;
+    if (dinBit < 0)
+    {
+        if (level) return;
+        dinBit = 0;             // start bit
+        dinByteStart = now;
+        return;
+    }
+    if (dinBit < 8)
+    {
+        dinByte = dinByte >> 1 | level << 7;
+        dinBit++;
+        return;
+    }
+    dinBit = -1;
+    if (!level)
+    {
+        dinFraming++;
+        return;
+    }
+    sent[sentHead % SENT_LEN].start = dinByteStart;
+    sent[sentHead % SENT_LEN].msg = dinEvents;
+    sent[sentHead++ % SENT_LEN].value = dinByte;
+    if (dinByte & 0x80)
+    {
+        dinData = 0;
+        dinNeed = (dinByte & 0xe0) == 0xc0 ? 1 : 2;
+        dinRunning = dinByte;
+        return;
+    }
+    if (!dinNeed) return;
+    if (!dinData) dinFirst = dinByte;
+    if (++dinData < dinNeed) return;
+    dinData = 0;
+    dinEvents++;
+    // the host's notes and LED level, the button sends other controllers
+    if (dinRunning == 0x90 || (MIDIFOOT_LEDS && dinFirst == MIDIFOOT_LED_CC_LEVEL)) dinThru++;
+}
+
+void uartCorrupt(long msg)
+{
+    if (msg == uartLast) return;
+    uartLast = msg;
+    uartCorrupted++;
+}
+
+// the UART received a byte that started at uartStart, or a framing error
+void uartReceived(uint8_t value, int framing)
+{
+    uartBytes++;
+    while ((uint8_t)(sentHead - sentTail) && sent[sentTail % SENT_LEN].start + 5 * BIT_CYCLES < uartStart)
+    {
+        uartCorrupt(sent[sentTail++ % SENT_LEN].msg);   // missed
+    }
+    if (!(uint8_t)(sentHead - sentTail)) return;
+    if (sent[sentTail % SENT_LEN].start > uartStart + 5 * BIT_CYCLES)
+    {
+        uartCorrupt(sent[sentTail % SENT_LEN].msg);     // one that wasn't sent
+        return;
+    }
+    if (framing || value != sent[sentTail % SENT_LEN].value) uartCorrupt(sent[sentTail % SENT_LEN].msg);
+    sentTail++;
+}
+
+// after the interrupt changed the pin
+void uartEdge(void)
+{
+    uint8_t level = (PORTB >> MIDIFOOT_DIN_PIN) & 1;
+    if (level == uartLevel) return;
+    uartLevel = level;
+    if (level || uartBit >= 0) return;
+    uartBit = 0;
+    uartStart = now;
+    uartNext = now + BIT_CYCLES / 2;
+}
+
+void uartSample(void)
+{
+    if (!uartBit && uartLevel)
+    {
+        uartBit = -1;           // too short for a start bit
+        uartNext = NEVER;
+        return;
+    }
+    if (uartBit == 9)
+    {
+        uartReceived(uartByte, !uartLevel);
+        uartBit = -1;
+        uartNext = NEVER;
+        return;
+    }
+    if (uartBit) uartByte = uartByte >> 1 | uartLevel << 7;
+    uartBit++;
+    uartNext += BIT_CYCLES;
+}
+#else
+#define dinMatch() NEVER
+#define dinWaiting 0
+#define uartNext NEVER
+#endif
+
+/* ---------------------------------- LED ---------------------------------- */
+
+#if MIDIFOOT_LEDS
+// the firmware's timer0 interrupts light the LED at each overflow while
+// FLAG_LED is set and the compare B match puts it out. The host sets the
+// level with -L at the start, and the time the LED is lit must match it.
+int ledValue = 64;
+uint64_t ledStart, ledLast, ledOn = 0;
+
+uint64_t ledMatch(void)
+{
+    if (!(TIMSK & (1 << OCIE0B))) return NEVER;
+    uint64_t count = now >> 6;
+    uint8_t ahead = OCR0B - (uint8_t)count;
+    return (count + (ahead ? ahead : 256)) << 6;
+}
+
+// the pin keeps its level until t
+void ledCount(uint64_t t)
+{
+    if (PORTB & (1 << MIDIFOOT_LED_PIN)) ledOn += t - ledLast;
+    ledLast = t;
+}
+#else
+#define ledMatch() NEVER
+#define ledCount(t)
+#endif
+
+/* ---------------------------- Simulated time ----------------------------- */
+
+// -t: the host streams notes to the MIDI OUT endpoint, two per packet, as
+// fast as the firmware takes them
+long thruLeft = 0, thruSent = 0, thruNaks = 0;
+uint64_t thruLast = 0;          // when the last packet went out
+uint64_t nextOut = NEVER;       // next OUT token, -O ms apart and 3.3 ms after an IN token
+uint64_t outCycles;
+#if MIDIFOOT_DIN_THRU
+
+void packetSend(void)
+{
+    if (!thruLeft) return;
+    busyUntil = now + BUSY_OUT(thruLeft > 1 ? 8 : 4);
+    if (usbRxLen)               // buffer busy or requests disabled
+    {
+        thruNaks++;
+        return;
+    }
+    uint8_t len = 0;
+    for (; thruLeft && len < 8; len += 4, thruLeft--, thruSent++)
+    {
+        rxData[len] = 0x09;     // note on, velocity 0 every other time
+        rxData[len + 1] = 0x90;
+        rxData[len + 2] = 60 + thruSent % 12;
+        rxData[len + 3] = thruSent & 1 ? 0 : 100;
+    }
+    usbRxToken = 1;
+    usbRxLen = len + 3;         // pid and crc, like the driver
+    thruLast = now;
+}
+#endif
+
+uint64_t dinDue, ledDue;        // compare matches, found before time passes
+
+uint64_t simNext(uint64_t next)
+{
+    dinDue = dinWaiting ? busyUntil : dinMatch();
+    ledDue = ledMatch();
+    if (nextEdge < next) next = nextEdge;
+    if (nextOut < next) next = nextOut;
+    if (dinDue < next) next = dinDue;
+    if (ledDue < next) next = ledDue;
+    if (uartNext < next) next = uartNext;
+    return next;
+}
+
+int simWait(uint64_t t)
+{
+    realtimeWait(t);
+    ledCount(t);
+    return 1;
+}
+
+void simEvent(void)
+{
+    if (now == nextEdge) edge();
+#if MIDIFOOT_DIN_THRU
+    if (now == nextOut)
+    {
+        packetSend();
+        nextOut += outCycles;
+    }
+#endif
+#if MIDIFOOT_DIN_OUT
+    if (now == dinDue && now < busyUntil) dinWaiting = 1;
+    else if (now == dinDue)
+    {
+        dinWaiting = 0;
+        TCNT0 = now >> 6;
+        dinInterrupt();
+        dinReceive();
+        uartEdge();
+    }
+    if (now == uartNext) uartSample();
+#endif
+#if MIDIFOOT_LEDS
+    if (now == ledDue) PORTB &= ~(1 << MIDIFOOT_LED_PIN);
+#endif
+}
+
+void simLoop(void)
+{
+    if (!lastEdge) // main loop reached, start pressing the button
+    {
+        lastEdge = now;
+        edgeNext();
+#if MIDIFOOT_LEDS
+        ledStart = ledLast = now;   // the LED packet is delivered next
+#endif
+    }
+    uint64_t settle = US(100000);
+#if MIDIFOOT_GESTURES
+    if (scripted) settle = US(SCRIPT_IDLE_MS * 1000);    // the last tap comes late
+#endif
+    if (nextEdge == NEVER && now > lastEdge + settle
+        && !thruLeft && now > thruLast + US(100000)) longjmp(done, 1);
+}
+
+/* -------------------------- Pattern generators --------------------------- */
+
+// in midifoot.c
+uint16_t patternLength(const uchar *pat);
+uint16_t patternNext(const uchar *pat, uint16_t step);
+uint16_t patternPrev(const uchar *pat, uint16_t step);
+uchar patternValue(const uchar *pat, uint16_t step);
+
+const uchar listPattern[] = {0x0B, 0xBE, 0x40, 4, 70, 0, 100, 30};
+const uchar bitrevPattern[] = {0x0B, 0xBE, 0x40, GEN_BITREV(4, 0, 127)};
+const uchar euclidPattern[] = {0x0B, 0xBE, 0x40, GEN_EUCLID(8, 3, 127, 0)};
+const uchar lfsrPattern[] = {0x0B, 0xBE, 0x40, GEN_LFSR(0, 255)};
+
+int patternFailed = 0;
+
+void patternExpect(const char *what, long got, long expect)
+{
+    if (got == expect) return;
+    if (patternFailed++ < 10) printf("FAIL: %s is %ld, not %ld\n", what, got, expect);
+}
+
+// the values of the first steps, and that patternPrev() undoes
+// patternNext() all the way round, across the wrap of the step number
+void patternSteps(const char *name, const uchar *pat, const uchar *values, int count)
+{
+    char what[64];
+    uint16_t step = patternLength(pat) ? 0 : patternNext(pat, 0);
+    for (int i = 0; i < count; i++, step = patternNext(pat, step))
+    {
+        snprintf(what, sizeof(what), "%s step %d", name, i);
+        patternExpect(what, patternValue(pat, step), values[i]);
+    }
+    long length = 0;
+    uint16_t first = step;
+    do
+    {
+        uint16_t next = patternNext(pat, step);
+        if (patternPrev(pat, next) != step)
+        {
+            snprintf(what, sizeof(what), "%s step before 0x%x", name, next);
+            patternExpect(what, patternPrev(pat, next), step);
+        }
+        step = next;
+        length++;
+    } while (step != first && length <= 65536);
+    snprintf(what, sizeof(what), "%s length", name);
+    patternExpect(what, length, patternLength(pat) ? patternLength(pat) : 65535);
+}
+
+// the generators against values worked out by hand, see patterns.h
+void patternCheck(void)
+{
+    const uchar list[] = {70, 0, 100, 30, 70};
+    patternSteps("list", listPattern, list, 5);
+    // bit reversed 4 bit step number, upper half on even steps
+    const uchar bitrev[] = {64, 0, 96, 32, 80, 16, 112, 48, 72, 8, 104, 40};
+    patternSteps("GEN_BITREV(4, 0, 127)", bitrevPattern, bitrev, 12);
+    const uchar euclid[] = {127, 0, 0, 127, 0, 0, 127, 0, 127};   // x..x..x.
+    patternSteps("GEN_EUCLID(8, 3, 127, 0)", euclidPattern, euclid, 9);
+    // states 0xace1 0xe270 0x7138 0x389c 0x1c4e 0x0e27 0xb313, each sends
+    // its two bytes xored together
+    const uchar lfsr[] = {0x4d, 0x92, 0x49, 0xa4, 0x52, 0x29, 0xa0};
+    patternSteps("GEN_LFSR(0, 255)", lfsrPattern, lfsr, 7);
+    uint16_t state = patternNext(lfsrPattern, 0);
+    const uint16_t states[] = {0xace1, 0xe270, 0x7138, 0x389c, 0x1c4e, 0x0e27, 0xb313};
+    for (int i = 0; i < 7; i++, state = patternNext(lfsrPattern, state))
+    {
+        patternExpect("GEN_LFSR state", state, states[i]);
+    }
+}
+
+/* -------------------------------- Driver --------------------------------- */
+
+#if MIDIFOOT_HEALTH || MIDIFOOT_MEMORY_STATS
+// read a vendor request like the host tools do
+usbMsgLen_t request(uchar rq, uchar **data)
+{
+    usbRequest_t setup = {0};
+    setup.bmRequestType = USBRQ_TYPE_VENDOR | USBRQ_DIR_DEVICE_TO_HOST;
+    setup.bRequest = rq;
+    setup.wLength.word = 255;
+    usbMsgLen_t len = usbFunctionSetup((uchar *)&setup);
+    *data = (uchar *)usbMsgPtr;
+    return len;
+}
+#endif
+
+void usage(void)
+{
+    fprintf(stderr, "usage: midifoot-sim [-n waveforms] [-l min_ms] [-h max_ms]"
+        " [-b bounces] [-i poll_ms] [-O out_ms] [-s seed] [-o file.vcd] [-m midi_out [-T press_times]]"
+        " [-t thru_events] [-L led_level] [-g] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    double pollMs = 10;         // bInterval of the endpoint
+    double outMs = MIDIFOOT_OUT_INTERVAL;
+    const char *vcd = NULL, *midi = NULL, *presses = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "n:l:h:b:i:O:s:o:m:T:t:L:gv")) != -1)
+    {
+        switch (c)
+        {
+        case 'n': waveforms = atol(optarg); break;
+        case 'l': holdMin = atof(optarg); break;
+        case 'h': holdMax = atof(optarg); break;
+        case 'b': bounceMax = atoi(optarg); break;
+        case 'i': pollMs = atof(optarg); break;
+        case 'O': outMs = atof(optarg); break;
+        case 's': rng = strtoull(optarg, 0, 0) | 1; break;
+        case 'o': vcd = optarg; break;
+        case 'm': midi = optarg; break;
+        case 'T': presses = optarg; break;
+        case 't': thruLeft = atol(optarg); break;
+#if MIDIFOOT_LEDS
+        case 'L': ledValue = atoi(optarg) & 127; break;
+#endif
+#if MIDIFOOT_GESTURES
+        case 'g': scripted = 1; break;
+#endif
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (holdMin < 0.3 || holdMax < holdMin || pollMs <= 0 || outMs <= 0) usage();
+    pollCycles = US(pollMs * 1000);
+    nextPoll = pollCycles;
+    outCycles = US(outMs * 1000);
+    if (MIDIFOOT_DIN_THRU) nextOut = pollCycles + US(3300);
+    PINB = (1 << PB0) | (1 << USB_CFG_DMINUS_BIT); // released, bus idle (J)
+    MCUSR = 1 << PORF;
+    usbConfiguration = 1;       // enumerated, the host polls the endpoints
+    OCR1C = 0xff;
+    if (vcd && vcdOpen(vcd, F_CPU, vcdSignals, VCD_SIGNALS))
+    {
+        return 2;
+    }
+    vcdChange(VCD_PB0, 0, 1);
+#if MIDIFOOT_LEDS
+    uchar ledPacket[4] = {0x0b, 0xb0 + MIDIFOOT_LED_CHANNEL - 1, MIDIFOOT_LED_CC_LEVEL, ledValue};
+    memcpy(rxData, ledPacket, 4);
+    usbRxLen = 4 + 3;           // waits for the first usbPoll()
+#if MIDIFOOT_DIN_THRU
+    thruSent = 1;               // goes out of the DIN socket as well
+#endif
+#endif
+    if (presses && !midi) usage();
+    if (midi && (midiFd = open(midi, O_WRONLY)) < 0)
+    {
+        perror(midi);
+        return 2;
+    }
+    if (presses && !(pressFile = fopen(presses, "w")))
+    {
+        perror(presses);
+        return 2;
+    }
+    wallStart = wallNow();
+
+#if MIDIFOOT_GESTURES
+    // the 16 bit tick count wraps around 11.3 s into the script, between
+    // the long press and the first hold of the "hold" gesture
+    extern uint16_t ticks;
+    if (scripted) ticks = -(uint16_t)(11300 * 1000 / 1024);
+#endif
+    patternCheck();
+    if (patternFailed) return 1;
+
+    clock_t start = clock();
+    if (!setjmp(done)) firmwareMain();
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    vcdClose();
+
+    long dropped = 0;
+#if MIDIFOOT_DIN_OUT
+    long dinDropped = 0, dinLate = 0;
+#endif
+#if MIDIFOOT_HEALTH
+    uchar *health;
+    if (request(MIDIFOOT_RQ_GET_HEALTH, &health))
+    {
+        dropped = health[2 * MIDIFOOT_HEALTH_DROPPED]
+            | health[2 * MIDIFOOT_HEALTH_DROPPED + 1] << 8;
+#if MIDIFOOT_DIN_OUT
+        dinDropped = health[2 * MIDIFOOT_HEALTH_DIN_DROPPED]
+            | health[2 * MIDIFOOT_HEALTH_DIN_DROPPED + 1] << 8;
+        dinLate = health[2 * MIDIFOOT_HEALTH_DIN_LATE]
+            | health[2 * MIDIFOOT_HEALTH_DIN_LATE + 1] << 8;
+#endif
+    }
+#endif
+    printf("waveforms   %ld (%.0f per second)\n", groups / 2, groups / 2 / elapsed);
+    printf("simulated   %.1f s in %.2f s\n", now / (double)F_CPU, elapsed);
+    printf("events      %ld sent, %ld dropped, %ld button changes\n",
+        events, dropped, expected);
+    if (latencyCount && !dropped)
+    {
+        printf("latency     min %.3f ms, mean %.3f ms, max %.3f ms\n",
+            latencyMin / (F_CPU / 1000.0),
+            latencySum / (double)latencyCount / (F_CPU / 1000.0),
+            latencyMax / (F_CPU / 1000.0));
+    }
+#if MIDIFOOT_DIN_THRU
+    printf("thru        %ld events from the host, %ld packets NAKed\n", thruSent, thruNaks);
+#endif
+#if MIDIFOOT_DIN_OUT
+    while ((uint8_t)(sentHead - sentTail)) uartCorrupt(sent[sentTail++ % SENT_LEN].msg);
+    printf("din         %ld events (%ld from the host), %ld dropped, %ld late bits, %ld framing errors\n",
+        dinEvents, dinThru, dinDropped, dinLate, dinFraming);
+    printf("uart        %ld bytes, %ld of %ld messages corrupted (%.3f%%)\n",
+        uartBytes, uartCorrupted, dinEvents, dinEvents ? 100.0 * uartCorrupted / dinEvents : 0);
+    // the drops are only counted with MIDIFOOT_HEALTH
+    if (dinFraming || (MIDIFOOT_HEALTH ? dinEvents + dinDropped != events + dropped + thruSent
+        : dinEvents > events + thruSent))
+    {
+        printf("FAIL: the DIN output should carry every event\n");
+        return 1;
+    }
+#if MIDIFOOT_DIN_THRU
+    // the button's events are dropped first, see DIN_THRU_PACKET
+    if (dinThru != thruSent)
+    {
+        printf("FAIL: the DIN output should carry every message from the host\n");
+        return 1;
+    }
+#endif
+    // unless the host is off the interval, or no gap fits between OUT packets
+    if (uartCorrupted && outMs == MIDIFOOT_OUT_INTERVAL && MIDIFOOT_OUT_INTERVAL >= 4)
+    {
+        printf("FAIL: DIN bytes should fit between the USB transactions\n");
+        return 1;
+    }
+#endif
+#if MIDIFOOT_LEDS
+    int level = ledValue >= 127 ? 256 : (ledValue * ledValue + 63) >> 6;
+    double lit = ledOn / (double)(now - ledStart);
+    printf("led         level %d, lit %.2f%% of the time\n", ledValue, lit * 100);
+    if (lit < level / 256.0 - 0.005 || lit > level / 256.0 + 0.005)
+    {
+        printf("FAIL: the LED should be lit %.2f%% of the time\n", level / 2.56);
+        return 1;
+    }
+#endif
+#if MIDIFOOT_MEMORY_STATS
+    uchar *memory;
+    request(MIDIFOOT_RQ_GET_MEMORY, &memory);
+    uint16_t ram[3];
+    memcpy(ram, memory, sizeof(ram));
+    printf("memory      %u static, %u stack, %u never used\n", ram[0], ram[1], ram[2]);
+    if (ram[0] != HOST_DATA || ram[1] != HOST_STACK
+        || ram[2] != sizeof(hostRam) - HOST_DATA - HOST_STACK)
+    {
+        printf("FAIL: the memory report should match the RAM image in host/mock.c\n");
+        return 1;
+    }
+#endif
+#if MIDIFOOT_GESTURES
+    if (scripted)
+    {
+        scriptCheck(SCRIPT_LEN - 1);
+        printf("script      %d gestures, %d sent the wrong messages\n", SCRIPT_LEN, scriptFailed);
+        if (scriptFailed) return 1;
+    }
+#endif
+    if (!MIDIFOOT_GESTURES && events + dropped != expected)
+    {
+        printf("FAIL: every button change should send one event\n");
+        return 1;
+    }
+    return 0;
+}
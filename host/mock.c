@@ -0,0 +1,156 @@
+/* Name: mock.c
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Simulated ATtiny85 registers and a mocked V-USB driver for the firmware
+ * in midifoot.c, shared by host/hostsim.c and host/virtual.c. Time only
+ * passes when the firmware calls usbPoll() (one main loop pass), sleeps or
+ * busy waits, and sleeping skips straight to the next event. The virtual
+ * host picks up interrupt data every poll interval and delivers OUT packets
+ * left in rxData at the next usbPoll(). Each transaction keeps the driver's
+ * interrupt busy (busyUntil), and the firmware waits for it.
+ */
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "midifootconfig.h"
+#include "mock.h"
+
+/* -------------------------- Simulated registers -------------------------- */
+
+volatile uint8_t PINB, PORTB, DDRB, MCUSR, SREG;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+volatile uint8_t TCCR1, TCNT1, OCR1A, OCR1B, OCR1C;
+volatile uint8_t GTCCR, TIMSK, TIFR, GIMSK, GIFR, PCMSK, MCUCR, ACSR, PRR;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2, OSCCAL;
+uint8_t hostSleepMode;
+
+uint64_t now;
+uint64_t nextTick = TICK_CYCLES;
+uint64_t nextPoll;
+uint64_t pollCycles;
+uint64_t busyUntil;
+jmp_buf done;
+
+/* ---------------------------------- RAM ---------------------------------- */
+
+// midifoot.c paints it for MIDIFOOT_MEMORY_STATS, and usbPoll() is called
+// with HOST_STACK bytes of it in use
+uint8_t hostRam[RAMEND + 1 - RAMSTART];
+uint16_t hostRamEnd = HOST_DATA;
+
+/* ------------------------------- VCD output ------------------------------ */
+
+const vcd_signal_t vcdSignals[] = {
+    {"buttonState", 1}, {"debounce", 1}, {"msgNum", 16}, {"queue", 8},
+    {"PB0", 1}, {"usbTxLen1", 8},
+};
+
+void hostVcd(uint8_t signal, uint16_t value)
+{
+    vcdChange(signal, now, value);
+}
+
+/* ------------------------------- V-USB mock ------------------------------ */
+
+usbMsgPtr_t usbMsgPtr;
+uchar usbMsgFlags;
+uchar usbConfiguration;
+uchar usbRxToken;
+volatile schar usbRxLen;
+usbTxStatus_t usbTxStatus1;
+
+uchar txData[8];
+uint8_t txLen;
+#if USB_CFG_IMPLEMENT_FN_WRITEOUT
+uchar rxData[8];
+#endif
+
+void usbInit(void)
+{
+    usbTxLen1 = USBPID_NAK;
+    vcdChange(VCD_TXLEN, now, usbTxLen1);
+}
+
+void usbSetInterrupt(uchar *data, uchar len)
+{
+    memcpy(txData, data, len);
+    txLen = len;
+    usbTxLen1 = len + 4;        // data, pid, crc and sync, like the driver
+    vcdChange(VCD_TXLEN, now, usbTxLen1);
+}
+
+void usbPoll(void)
+{
+    memset(hostRam + sizeof(hostRam) - HOST_STACK, 0, HOST_STACK);
+    simLoop();
+#if USB_CFG_IMPLEMENT_FN_WRITEOUT
+    if (usbRxLen > 0)
+    {
+        usbFunctionWriteOut(rxData, usbRxLen - 3);
+        if (usbRxLen > 0) usbRxLen = 0; // unless the firmware disabled requests
+    }
+#endif
+    advance(now + PASS_CYCLES);
+}
+
+/* ---------------------------- Simulated time ----------------------------- */
+
+// let simulated time pass up to t
+void advance(uint64_t t)
+{
+    uint64_t from = now;
+    for (;;)
+    {
+        uint64_t next = simNext(nextTick < nextPoll ? nextTick : nextPoll);
+        if (next > t) break;
+        if (!simWait(next)) continue;
+        now = next;
+        if (now == nextTick)
+        {
+#if MIDIFOOT_LEDS
+            if (GPIOR0 & (1 << FLAG_LED)) PORTB |= 1 << MIDIFOOT_LED_PIN;
+#endif
+            GPIOR0 |= 1 << FLAG_TICK;
+            GPIOR0 |= 1 << FLAG_BUS; // low speed keep-alive every ms
+            nextTick += TICK_CYCLES;
+        }
+        if (now == nextPoll)
+        {
+            busyUntil = now + BUSY_NAK;
+            if (!usbInterruptIsReady())
+            {
+                busyUntil = now + BUSY_IN(txLen);
+                packetReceived();
+                usbTxLen1 = USBPID_NAK;
+                vcdChange(VCD_TXLEN, now, usbTxLen1);
+            }
+            nextPoll += pollCycles;
+        }
+        simEvent();
+        if (busyUntil > t) t = busyUntil;   // the firmware waits for the driver
+    }
+    // timer1 runs at F_CPU / 128 and restarts after OCR1C in CTC mode
+    uint32_t counts = (t >> 7) - (from >> 7);
+    if (TCCR1 & (1 << CTC1)) TCNT1 = (TCNT1 + counts) % (OCR1C + 1);
+    else TCNT1 = TCNT1 + counts;
+    now = t;
+    TCNT0 = now >> 6;
+}
+
+// wake up on the next interrupt, a timer0 tick, pin change or USB packet.
+// The virtual host sends keep-alives and never suspends the bus, so the
+// firmware doesn't power down.
+void hostSleep(void)
+{
+    advance(simNext(nextTick < nextPoll ? nextTick : nextPoll));
+}
+
+void hostDelay(double us)
+{
+    advance(now + US(us));
+}
@@ -0,0 +1,73 @@
+/* Name: mock.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#ifndef __mock_h_included__
+#define __mock_h_included__
+
+/* The simulated ATtiny85 and V-USB driver that host/hostsim.c and
+ * host/virtual.c run the firmware against, see host/mock.c. Time is counted
+ * in cpu cycles and passes in advance(), which handles the timer0 tick and
+ * the host's poll of the interrupt endpoint, and leaves everything else to
+ * the program through the sim*() functions it defines.
+ */
+
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "usbdrv.h"
+#include "vcd.h"
+
+#define FLAG_TICK 0             // GPIOR0 bits set by the interrupts in midifoot.c
+#define FLAG_BUS 1
+#define FLAG_LED 3
+
+#define PASS_CYCLES 200         // a main loop pass that doesn't sleep
+#define TICK_CYCLES 16384       // timer0 overflow, prescaler 64
+#define NEVER UINT64_MAX
+#define US(us) ((uint64_t)((us) * (F_CPU / 1000000.0)))
+
+#define HOST_DATA 200           // static data and stack in the RAM image
+#define HOST_STACK 48
+
+// the firmware's trace points, then what the mock sees
+#define VCD_PB0 MIDIFOOT_VCD_COUNT
+#define VCD_TXLEN (MIDIFOOT_VCD_COUNT + 1)
+#define VCD_SIGNALS (MIDIFOOT_VCD_COUNT + 2)
+extern const vcd_signal_t vcdSignals[];
+
+// V-USB keeps interrupts off for a whole transaction, from the token to the
+// end of its answer: an IN token and NAK take 36 us at low speed (0.67 us a
+// bit), a data packet about 0.72 us per bit with its stuffing on top
+#define BUSY_NAK US(36)
+#define BUSY_IN(len) US(50 + 6 * (len))    // IN token and data
+#define BUSY_OUT(len) US(66 + 6 * (len))   // OUT token, data and handshake
+extern uint64_t busyUntil;      // the driver's interrupt runs until then
+
+extern uint64_t now;            // cpu cycles since reset
+extern uint64_t nextTick;
+extern uint64_t nextPoll;       // next IN token to the interrupt endpoint
+extern uint64_t pollCycles;
+extern jmp_buf done;            // longjmp here to leave firmwareMain()
+
+extern volatile schar usbRxLen; // driver variables usbdrv.h keeps to itself
+extern uchar usbRxToken;
+extern uchar txData[8];         // last packet given to usbSetInterrupt()
+extern uint8_t txLen;
+#if USB_CFG_IMPLEMENT_FN_WRITEOUT
+extern uchar rxData[8];         // OUT packet for the next usbPoll()
+#endif
+
+void advance(uint64_t t);
+
+// defined by the program
+uint64_t simNext(uint64_t next);    // its earliest event, if before next
+int simWait(uint64_t t);            // until t, 0 if an earlier event came up
+void simEvent(void);                // handle its events due at now
+void simLoop(void);                 // one main loop pass
+void packetReceived(void);          // the host picked up txData
+
+#endif /* __mock_h_included__ */
@@ -0,0 +1,18 @@
+/* Name: delay.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Busy waits let the same amount of simulated time pass. */
+
+#ifndef __host_delay_h_included__
+#define __host_delay_h_included__
+
+extern void hostDelay(double us);
+
+#define _delay_us(us)   hostDelay(us)
+#define _delay_ms(ms)   hostDelay((ms) * 1000.0)
+
+#endif /* __host_delay_h_included__ */
@@ -0,0 +1,65 @@
+/* Name: vcd.c
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include "vcd.h"
+
+#define VCD_MAX 32
+
+FILE *vcdFile;
+double vcdPsPerCycle;
+int vcdCount;
+uint8_t vcdWidth[VCD_MAX];
+uint32_t vcdValue[VCD_MAX];
+uint8_t vcdKnown[VCD_MAX];
+uint64_t vcdTime = ~0ULL;       // of the last "#" line
+
+int vcdOpen(const char *path, double fcpu, const vcd_signal_t *signals, int count)
+{
+    vcdFile = fopen(path, "w");
+    if (!vcdFile || count > VCD_MAX)
+    {
+        perror(path);
+        return -1;
+    }
+    vcdPsPerCycle = 1e12 / fcpu;
+    vcdCount = count;
+    fprintf(vcdFile, "$timescale 1ps $end\n$scope module midifoot $end\n");
+    for (int i = 0; i < count; i++)
+    {
+        vcdWidth[i] = signals[i].width;
+        fprintf(vcdFile, "$var wire %d %c %s $end\n", signals[i].width, '!' + i,
+            signals[i].name);
+    }
+    fprintf(vcdFile, "$upscope $end\n$enddefinitions $end\n");
+    return 0;
+}
+
+void vcdChange(int signal, uint64_t cycle, uint32_t value)
+{
+    if (!vcdFile || signal < 0 || signal >= vcdCount) return;
+    if (vcdKnown[signal] && vcdValue[signal] == value) return;
+    vcdKnown[signal] = 1;
+    vcdValue[signal] = value;
+    uint64_t t = (uint64_t)(cycle * vcdPsPerCycle + 0.5);
+    if (t != vcdTime) fprintf(vcdFile, "#%llu\n", (unsigned long long)t);
+    vcdTime = t;
+    if (vcdWidth[signal] == 1)
+    {
+        fprintf(vcdFile, "%d%c\n", value & 1, '!' + signal);
+        return;
+    }
+    fputc('b', vcdFile);
+    for (int i = vcdWidth[signal] - 1; i >= 0; i--) fputc('0' + ((value >> i) & 1), vcdFile);
+    fprintf(vcdFile, " %c\n", '!' + signal);
+}
+
+void vcdClose(void)
+{
+    if (vcdFile) fclose(vcdFile);
+    vcdFile = NULL;
+}
@@ -0,0 +1,30 @@
+/* Name: vcd.h
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#ifndef __vcd_h_included__
+#define __vcd_h_included__
+
+/* Writes signals to a value change dump for GTKWave. Times are cpu cycles,
+ * converted with the clock given to vcdOpen(). Changes must come in time
+ * order, values that didn't change are not written. Without vcdOpen() every
+ * call does nothing.
+ */
+
+#include <stdint.h>
+
+typedef struct
+{
+    const char *name;
+    uint8_t width;              // bits
+} vcd_signal_t;
+
+// signals are numbered by their index in the table
+int vcdOpen(const char *path, double fcpu, const vcd_signal_t *signals, int count);
+void vcdChange(int signal, uint64_t cycle, uint32_t value);
+void vcdClose(void);
+
+#endif /* __vcd_h_included__ */
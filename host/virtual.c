@@ -0,0 +1,345 @@
+/* Name: virtual.c
+ * Project: MidiFoot host build
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* A virtual MidiFoot: the firmware in midifoot.c, built for the host and
+ * run against host/mock.c as for hostsim.c, but in real time and sending its MIDI messages from an ALSA
+ * sequencer port. The button is pressed by commands from stdin, from
+ * clients of a unix socket, from the keyboard, or automatically at a fixed
+ * rate. Debounce, pattern, gestures and the 10 ms USB polling behave like
+ * the device, because it is the same code.
+ *
+ * Each process is one device, start as many as needed for load tests:
+ *   for i in $(seq 20); do host/midifoot-virtual -a 50 & done
+ *
+ * Commands, one per line:
+ *   p, press           press the button
+ *   r, release         release it
+ *   t, tap [ms]        press, and release after ms (default 50)
+ *   q, quit
+ *
+ * Build with "make virtual" (needs the ALSA headers, libasound2-dev).
+ */
+
+#define _GNU_SOURCE             // ppoll()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <alsa/asoundlib.h>
+#include <avr/io.h>
+
+#include "midifootconfig.h"
+#include "mock.h"
+
+extern int firmwareMain(void);  // main() of midifoot.c, renamed by the Makefile
+
+int64_t wallStart;              // CLOCK_MONOTONIC ns at cycle 0
+
+/* ---------------------------- Sequencer port ----------------------------- */
+
+snd_seq_t *seq;
+int seqPort;
+snd_midi_event_t *encoder;
+long sent;
+int verbose = 0;
+
+void seqSend(const uchar *msg, int len)
+{
+    snd_seq_event_t ev;
+    for (int i = 0; i < len; i++)
+    {
+        snd_seq_ev_clear(&ev);  // the encoder only fills in the message
+        if (snd_midi_event_encode_byte(encoder, msg[i], &ev) != 1) continue;
+        snd_seq_ev_set_source(&ev, seqPort);
+        snd_seq_ev_set_subs(&ev);
+        snd_seq_ev_set_direct(&ev);
+        snd_seq_event_output_direct(seq, &ev);
+    }
+    sent++;
+    if (verbose) printf("%02x %02x %02x\n", msg[0], msg[1], msg[2]);
+}
+
+/* ------------------------------ Button input ----------------------------- */
+
+// edges to come, in time order
+#define EDGES_MAX 64
+struct
+{
+    uint64_t when;
+    uint8_t level;
+} edges[EDGES_MAX];
+int edgeCount;
+double autoRate = 0;            // taps per second, -a
+uint64_t nextAuto = NEVER;
+double tapMs = 50;
+
+// commands take effect at the time they arrive
+uint64_t inputNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t ns = ts.tv_sec * 1000000000LL + ts.tv_nsec - wallStart;
+    uint64_t t = (uint64_t)(ns * (F_CPU / 1e9));
+    return t > now ? t : now;
+}
+
+void edgeAdd(uint64_t when, uint8_t level)
+{
+    if (edgeCount == EDGES_MAX) return;
+    int i = edgeCount++;
+    for (; i && edges[i - 1].when > when; i--) edges[i] = edges[i - 1];
+    edges[i].when = when;
+    edges[i].level = level;
+}
+
+void tap(uint64_t when, double ms)
+{
+    edgeAdd(when, 0);
+    edgeAdd(when + US(ms * 1000), 1);
+}
+
+void command(char *line)
+{
+    char *cmd = strtok(line, " \t\r\n");
+    char *arg = strtok(NULL, " \t\r\n");
+    if (!cmd) return;
+    if (!strcmp(cmd, "p") || !strcmp(cmd, "press")) edgeAdd(inputNow(), 0);
+    else if (!strcmp(cmd, "r") || !strcmp(cmd, "release")) edgeAdd(inputNow(), 1);
+    else if (!strcmp(cmd, "t") || !strcmp(cmd, "tap")) tap(inputNow(), arg ? atof(arg) : tapMs);
+    else if (!strcmp(cmd, "q") || !strcmp(cmd, "quit")) longjmp(done, 1);
+    else fprintf(stderr, "midifoot-virtual: unknown command %s\n", cmd);
+}
+
+// input sources: stdin (lines or keys), a listening socket and its clients
+#define FDS_MAX 32
+struct pollfd fds[FDS_MAX];
+char lineBuf[FDS_MAX][128];
+int lineLen[FDS_MAX];
+int fdCount;
+int keyboard = 0;               // -k: any key taps, q quits
+int listener = -1;
+
+void inputRead(int i)
+{
+    char buf[256];
+    ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+    if (n <= 0)
+    {
+        if (fds[i].fd == STDIN_FILENO)
+        {
+            fds[i].fd = -1;     // stdin closed, keep running
+            return;
+        }
+        close(fds[i].fd);
+        fds[i] = fds[--fdCount];
+        lineLen[i] = lineLen[fdCount];
+        memcpy(lineBuf[i], lineBuf[fdCount], sizeof(lineBuf[i]));
+        return;
+    }
+    for (ssize_t k = 0; k < n; k++)
+    {
+        if (keyboard && fds[i].fd == STDIN_FILENO)
+        {
+            if (buf[k] == 'q' || buf[k] == 3) longjmp(done, 1);
+            tap(inputNow(), tapMs);
+            continue;
+        }
+        if (buf[k] == '\n' || lineLen[i] == sizeof(lineBuf[i]) - 1)
+        {
+            lineBuf[i][lineLen[i]] = 0;
+            lineLen[i] = 0;
+            command(lineBuf[i]);
+        }
+        else lineBuf[i][lineLen[i]++] = buf[k];
+    }
+}
+
+// wait for input until the clock reaches cycle t
+void inputWait(uint64_t t)
+{
+    for (;;)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t left = wallStart + (int64_t)(t * (1e9 / F_CPU))
+            - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+        if (left < 0) left = 0;
+        struct timespec timeout = {left / 1000000000, left % 1000000000};
+        if (ppoll(fds, fdCount, &timeout, NULL) <= 0) return;
+        for (int i = 0; i < fdCount; i++)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) continue;
+            if (fds[i].fd == listener)
+            {
+                int fd = accept(listener, NULL, NULL);
+                if (fd < 0 || fdCount == FDS_MAX)
+                {
+                    if (fd >= 0) close(fd);
+                    continue;
+                }
+                lineLen[fdCount] = 0;
+                fds[fdCount].fd = fd;
+                fds[fdCount++].events = POLLIN;
+            }
+            else inputRead(i);
+        }
+        if (edgeCount && edges[0].when <= t) return;    // a command came in
+    }
+}
+
+/* ------------------------------ Time keeping ----------------------------- */
+
+uint64_t simNext(uint64_t next)
+{
+    if (edgeCount && edges[0].when < next) next = edges[0].when;
+    if (nextAuto < next) next = nextAuto;
+    return next;
+}
+
+// time never runs ahead of the clock
+int simWait(uint64_t t)
+{
+    inputWait(t);
+    return !edgeCount || edges[0].when >= t;
+}
+
+void simEvent(void)
+{
+    while (edgeCount && edges[0].when <= now)
+    {
+        uint8_t level = edges[0].level;
+        memmove(edges, edges + 1, --edgeCount * sizeof(edges[0]));
+        if (!!(PINB & (1 << PB0)) == level) continue;
+        PINB ^= 1 << PB0;
+        GPIOR0 |= 1 << FLAG_BUS;
+    }
+    if (now == nextAuto)
+    {
+        tap(now, 500 / autoRate);
+        nextAuto += US(1e6 / autoRate);
+    }
+}
+
+void simLoop(void)
+{
+}
+
+void packetReceived(void)
+{
+    for (uint8_t i = 0; i < txLen; i += 4) seqSend(txData + i + 1, 3);
+}
+
+/* -------------------------------- Driver --------------------------------- */
+
+struct termios termSaved;
+
+void termRestore(void)
+{
+    tcsetattr(STDIN_FILENO, TCSANOW, &termSaved);
+}
+
+void onSignal(int sig)
+{
+    if (keyboard) termRestore();
+    _exit(0);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "usage: midifoot-virtual [-n name] [-s socket] [-k] [-a taps_per_s]"
+        " [-t tap_ms] [-i poll_ms] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = "MidiFoot Virtual";
+    const char *socketPath = NULL;
+    double pollMs = 10;
+    int c;
+    while ((c = getopt(argc, argv, "n:s:ka:t:i:v")) != -1)
+    {
+        switch (c)
+        {
+        case 'n': name = optarg; break;
+        case 's': socketPath = optarg; break;
+        case 'k': keyboard = 1; break;
+        case 'a': autoRate = atof(optarg); break;
+        case 't': tapMs = atof(optarg); break;
+        case 'i': pollMs = atof(optarg); break;
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (pollMs <= 0 || tapMs <= 0 || autoRate < 0) usage();
+    // the debounce needs about 0.2 ms of quiet on both sides of a tap
+    if (autoRate && 500 / autoRate < 0.5) usage();
+
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0)
+    {
+        fprintf(stderr, "midifoot-virtual: can't open the ALSA sequencer\n");
+        return 2;
+    }
+    snd_seq_set_client_name(seq, name);
+    seqPort = snd_seq_create_simple_port(seq, "MIDI 1",
+        SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_HARDWARE);
+    snd_midi_event_new(16, &encoder);
+    printf("sequencer port %d:%d\n", snd_seq_client_id(seq), seqPort);
+    fflush(stdout);
+
+    fds[fdCount].fd = STDIN_FILENO;
+    fds[fdCount++].events = POLLIN;
+    if (keyboard)
+    {
+        struct termios raw;
+        tcgetattr(STDIN_FILENO, &termSaved);
+        raw = termSaved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        atexit(termRestore);
+    }
+    if (socketPath)
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+        unlink(socketPath);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr))
+            || listen(listener, 4))
+        {
+            perror(socketPath);
+            return 2;
+        }
+        fds[fdCount].fd = listener;
+        fds[fdCount++].events = POLLIN;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    wallStart = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    pollCycles = US(pollMs * 1000);
+    nextPoll = pollCycles;
+    if (autoRate) nextAuto = US(300000);    // after the firmware's start delay
+    PINB = (1 << PB0) | (1 << USB_CFG_DMINUS_BIT); // released, bus idle (J)
+    MCUSR = 1 << PORF;
+    OCR1C = 0xff;
+
+    if (!setjmp(done)) firmwareMain();
+    if (socketPath) unlink(socketPath);
+    fprintf(stderr, "midifoot-virtual: %ld messages sent\n", sent);
+    return 0;
+}
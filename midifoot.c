@@ -8,12 +8,21 @@
 #include <avr/pgmspace.h>   /* required by usbdrv.h */
 #include <util/delay.h>     /* for _delay_ms() */
 #include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <avr/power.h>
+#include <avr/eeprom.h>
+#include <string.h>         /* for memcpy() */
 
+#include "midifootconfig.h"
+#include "requests.h"
+#include "patterns.h"
 #include "usbdrv.h"
 #if USE_INCLUDE
 #include "usbdrv.c"
 #endif
 
+extern volatile schar usbRxLen; // received packet length, usbdrv.h only exports it with flow control
+
 // This descriptor is based on http://www.usb.org/developers/devclass_docs/midi10.pdf
 // 
 // Appendix B. Example: Simple MIDI Adapter (Informative)
@@ -31,7 +40,7 @@ const static PROGMEM char deviceDescrMIDI[] = {    /* USB device descriptor */
     USB_CFG_DEVICE_VERSION,    /* 2 bytes */
     1,            /* manufacturer string index */
     2,            /* product string index */
-    0,            /* serial number string index */
+    MIDIFOOT_SERIAL ? 3 : 0,    /* serial number string index */
     1,            /* number of configurations */
 };
 
@@ -44,10 +53,11 @@ const static PROGMEM char configDescrMIDI[] = {    /* USB configuration descript
     1,            /* index of this configuration */
     0,            /* configuration name string index */
 #if USB_CFG_IS_SELF_POWERED
-    USBATTR_SELFPOWER,    /* attributes */
+    USBATTR_SELFPOWER
 #else
-    USBATTR_BUSPOWER,    /* attributes */
+    USBATTR_BUSPOWER
 #endif
+    | (MIDIFOOT_REMOTE_WAKEUP ? USBATTR_REMOTEWAKE : 0),    /* attributes */
     USB_CFG_MAX_BUS_POWER / 2,    /* max USB current in 2mA units */
 
 // B.3 AudioControl Interface Descriptors
@@ -155,7 +165,7 @@ const static PROGMEM char configDescrMIDI[] = {    /* USB configuration descript
     0x1,            /* bEndpointAddress OUT endpoint number 1 */
     3,            /* bmAttributes: 2:Bulk, 3:Interrupt endpoint */
     8, 0,            /* wMaxPacketSize */
-    10,            /* bIntervall in ms */
+    MIDIFOOT_OUT_INTERVAL,    /* bIntervall in ms */
     0,            /* bRefresh */
     0,            /* bSyncAddress */
 
@@ -187,24 +197,89 @@ const static PROGMEM char configDescrMIDI[] = {    /* USB configuration descript
     3,            /* baAssocJackID (0) */
 };
 
+#if MIDIFOOT_SERIAL
+// serial number string descriptor, the ID from EEPROM in hex digits
+uint32_t serialSaved EEMEM;
+uint32_t serialId;
+uint8_t serialSavePos = sizeof(uint32_t);   // next byte to save, sizeof when done
+uint16_t serialDescr[9] = {USB_STRING_DESCRIPTOR_HEADER(8)};
+
+void serialSet(uint32_t id)
+{
+    serialId = id;
+    for (uint8_t i = 8; i; i--)
+    {
+        uint8_t digit = id & 15;
+        serialDescr[i] = digit < 10 ? '0' + digit : 'A' - 10 + digit;
+        id >>= 4;
+    }
+}
+
+// write the next byte of a new ID, like healthPoll()
+void serialPoll(void)
+{
+    if (serialSavePos < sizeof(serialId) && eeprom_is_ready())
+    {
+        eeprom_update_byte((uint8_t *)&serialSaved + serialSavePos,
+            ((uint8_t *)&serialId)[serialSavePos]);
+        serialSavePos++;
+    }
+}
+
+#ifndef MIDIFOOT_HOST
+// a new ID from the jitter between the watchdog oscillator and the crystal:
+// timer0 runs at the full clock and is sampled at 32 watchdog timeouts of
+// 16 ms. Interrupts are still off, the timeouts only set WDIF.
+uint32_t serialRandom(void)
+{
+    uint32_t id = 0;
+    TCCR0B = (1 << CS00);
+    WDTCR = (1 << WDIE);
+    for (uint8_t i = 0; i < 32; i++)
+    {
+        while (!(WDTCR & (1 << WDIF)));
+        WDTCR |= (1 << WDIF);   // cleared by writing 1
+        id = (id << 3 | id >> 29) ^ TCNT0;
+    }
+    WDTCR = 0;
+    TCCR0B = 0;
+    return id;
+}
+#endif
+
+// read the ID, or make one up when the EEPROM is erased
+void serialInit(void)
+{
+    uint32_t id;
+    eeprom_read_block(&id, &serialSaved, sizeof(id));
+#ifndef MIDIFOOT_HOST
+    if (id == 0xffffffff)
+    {
+        id = serialRandom();
+        eeprom_update_block(&id, &serialSaved, sizeof(id));
+    }
+#endif
+    serialSet(id);
+}
+#endif
+
 // provide the custom descriptor
 usbMsgLen_t usbFunctionDescriptor(usbRequest_t * rq)
 {
     if (rq->wValue.bytes[1] == USBDESCR_DEVICE) {
         usbMsgPtr = (uchar *) deviceDescrMIDI;
         return sizeof(deviceDescrMIDI);
+#if MIDIFOOT_SERIAL
+    } else if (rq->wValue.bytes[1] == USBDESCR_STRING) {    /* the serial number, no other string is dynamic */
+        usbMsgPtr = (uchar *) serialDescr;
+        return sizeof(serialDescr);
+#endif
     } else {        /* must be config descriptor */
         usbMsgPtr = (uchar *) configDescrMIDI;
         return sizeof(configDescrMIDI);
     }
 }
 
-// no special setup needed
-usbMsgLen_t usbFunctionSetup(uchar data[8])
-{
-    return 0;
-}
-
 // midi packets
 // byte 0: packet header - cable number (always 0), code index (msg type)
 // midi byte 1 - msg type, channel
@@ -218,35 +293,1042 @@ usbMsgLen_t usbFunctionSetup(uchar data[8])
 //   C - program change
 //   D - channel pressure
 //   E - pitch bend
-uchar midiPkt[16][4] = {
-    {0x0B, 0xBE, 0x40, 0x46}, // [0]  ch15 cc64 (hold pedal) =  70 (on)
-    {0x0B, 0xBE, 0x40, 0x00}, // [1]  ch15 cc64 (hold pedal) =   0 (off)
-    {0x0B, 0xBE, 0x40, 0x64}, // [2]  ch15 cc64 (hold pedal) = 100 (on)
-    {0x0B, 0xBE, 0x40, 0x1e}, // [3]  ch15 cc64 (hold pedal) =  30 (off)
-    {0x0B, 0xBE, 0x40, 0x55}, // [4]  ch15 cc64 (hold pedal) =  85 (on)
-    {0x0B, 0xBE, 0x40, 0x0f}, // [5]  ch15 cc64 (hold pedal) =  15 (off)
-    {0x0B, 0xBE, 0x40, 0x73}, // [6]  ch15 cc64 (hold pedal) = 115 (on)
-    {0x0B, 0xBE, 0x40, 0x2d}, // [7]  ch15 cc64 (hold pedal) =  45 (off)
-    {0x0B, 0xBE, 0x40, 0x4b}, // [8]  ch15 cc64 (hold pedal) =  75 (on)
-    {0x0B, 0xBE, 0x40, 0x05}, // [9]  ch15 cc64 (hold pedal) =   5 (off)
-    {0x0B, 0xBE, 0x40, 0x69}, // [10] ch15 cc64 (hold pedal) = 105 (on)
-    {0x0B, 0xBE, 0x40, 0x23}, // [11] ch15 cc64 (hold pedal) =  35 (off)
-    {0x0B, 0xBE, 0x40, 0x50}, // [12] ch15 cc64 (hold pedal) =  80 (on)
-    {0x0B, 0xBE, 0x40, 0x0a}, // [13] ch15 cc64 (hold pedal) =  10 (off)
-    {0x0B, 0xBE, 0x40, 0x6e}, // [14] ch15 cc64 (hold pedal) = 110 (on)
-    {0x0B, 0xBE, 0x40, 0x28}, // [15] ch15 cc64 (hold pedal) =  40 (off)
+//
+// patterns are kept in flash, see patterns.h for the format and the
+// generators (GEN_BITREV, GEN_EUCLID, GEN_LFSR) that can replace the values.
+
+const static PROGMEM uchar midiPattern[] = {
+    0x0B, 0xBE, 0x40,   // ch15 cc64 (hold pedal)
+    16,
+    70,  0, 100, 30,    // [0]-[3]   on, off, on, off
+    85, 15, 115, 45,    // [4]-[7]
+    75,  5, 105, 35,    // [8]-[11]
+    80, 10, 110, 40,    // [12]-[15]
+};
+uint16_t msgNum = 0;
+uint8_t lastReading = 1;        // last raw reading of PB0
+uint8_t buttonState = 1;        // debounced state, 0 = pressed
+uint16_t ticks = 0;             // timer0 overflows, 1.024 ms each
+
+// midi packets waiting for the interrupt endpoint
+#define EVENT_QUEUE_LEN 8       // must be a power of 2
+uchar eventQueue[EVENT_QUEUE_LEN][4];
+uint8_t eventHead = 0;          // next free entry
+uint8_t eventTail = 0;          // next entry to send
+
+#define HAVE_STATS (MIDIFOOT_LATENCY_STATS || MIDIFOOT_LOOP_STATS)
+#if HAVE_STATS || MIDIFOOT_TRACE
+uint16_t timeNow(void);
+#endif
+
+#if HAVE_STATS
+// min, max and a log2 histogram of a time, see requests.h
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint8_t hist[16];
+} stat_t;
+
+void statAdd(stat_t *s, uint16_t t)
+{
+    uint8_t n = 0;
+    if (t < s->min) s->min = t;
+    if (t > s->max) s->max = t;
+    while (t && n < 15)
+    {
+        t >>= 1;
+        n++;
+    }
+    if (++s->hist[n] == 0)      // full, halve all buckets to keep the shape
+    {
+        for (uint8_t i = 0; i < 16; i++) s->hist[i] >>= 1;
+        s->hist[n] = 128;
+    }
+}
+
+void statReset(stat_t *s, uint8_t count)
+{
+    memset(s, 0, count * sizeof(stat_t));
+    while (count--) s++->min = 0xffff;
+}
+#endif
+
+#if MIDIFOOT_LATENCY_STATS
+stat_t latency[MIDIFOOT_LATENCY_COUNT];
+uint16_t eventOrigin;           // when the button change or timeout happened
+uint16_t eventEdge;             // first edge of the change being debounced
+uint16_t queueOrigin[EVENT_QUEUE_LEN];
+uint16_t queuePushed[EVENT_QUEUE_LEN];
+uint16_t armOrigin;             // of the oldest event in the armed packet
+uint16_t armTime;               // when usbSetInterrupt() was called
+uint8_t armed = 0;
+#endif
+
+#if MIDIFOOT_LOOP_STATS
+stat_t loopStats[MIDIFOOT_LOOP_COUNT];
+uint16_t loopStart;             // when the current loop pass began
+uint8_t loopSkip = 1;           // don't count the interval after startup or suspend
+#endif
+
+#if MIDIFOOT_TRACE
+// trace records in a ring, the oldest ones are overwritten, see requests.h
+// for the format. Only called from the main loop, never from an interrupt.
+#define TRACE_MASK (MIDIFOOT_TRACE_LEN - 1)
+uchar traceBuf[MIDIFOOT_TRACE_LEN];
+uint8_t traceHead = 0;          // next free byte
+uint8_t traceTail = 0;          // first byte of the oldest record
+uint8_t traceReadLeft = 0;      // bytes left to send with MIDIFOOT_RQ_GET_TRACE
+
+void traceWrite(uchar id, uchar *data, uchar len)
+{
+    uint16_t t = timeNow();
+    if (len > MIDIFOOT_TRACE_LEN - 5) len = MIDIFOOT_TRACE_LEN - 5;
+    while (((traceTail - traceHead - 1) & TRACE_MASK) < len + 4)
+    {
+        if (traceReadLeft) return;  // traceTail may be inside a record
+        traceTail = (traceTail + 4 + traceBuf[(traceTail + 1) & TRACE_MASK]) & TRACE_MASK;
+    }
+    uint8_t i = traceHead;
+    traceBuf[i] = id;
+    traceBuf[i = (i + 1) & TRACE_MASK] = len;
+    traceBuf[i = (i + 1) & TRACE_MASK] = t;
+    traceBuf[i = (i + 1) & TRACE_MASK] = t >> 8;
+    while (len--) traceBuf[i = (i + 1) & TRACE_MASK] = *data++;
+    traceHead = (i + 1) & TRACE_MASK;
+}
+#define TRACE(id, data, len) traceWrite(id, (uchar *)(data), len)
+
+// start a readout of the whole records that fit into max bytes
+void traceReadStart(uint16_t max)
+{
+    traceTail = (traceTail + traceReadLeft) & TRACE_MASK; // rest of an aborted readout
+    uint8_t i = traceTail;
+    traceReadLeft = 0;
+    while (i != traceHead)
+    {
+        uint8_t size = 4 + traceBuf[(i + 1) & TRACE_MASK];
+        if (traceReadLeft + size > max) break;
+        traceReadLeft += size;
+        i = (i + size) & TRACE_MASK;
+    }
+}
+
+// called by the driver for each chunk of the reply, see usbdrv.h
+uchar usbFunctionRead(uchar *data, uchar len)
+{
+    if (len > traceReadLeft) len = traceReadLeft;
+    traceReadLeft -= len;
+    for (uint8_t i = 0; i < len; i++)
+    {
+        data[i] = traceBuf[traceTail];
+        traceTail = (traceTail + 1) & TRACE_MASK;
+    }
+    return len;
+}
+#else
+#define TRACE(id, data, len)
+#endif
+
+// trace points for the host simulation, see MIDIFOOT_VCD in midifootconfig.h
+#if MIDIFOOT_VCD && defined(MIDIFOOT_HOST)
+void hostVcd(uint8_t signal, uint16_t value);   // in host/mock.c
+#define VCD(signal, value) hostVcd(signal, value)
+#else
+#define VCD(signal, value)
+#endif
+#define VCD_QUEUE() VCD(MIDIFOOT_VCD_QUEUE, (eventHead - eventTail) & (EVENT_QUEUE_LEN - 1))
+
+#if MIDIFOOT_HEALTH
+// fault counters, see requests.h. They live in RAM that isn't cleared on
+// reset and are saved to EEPROM now and then. A save that races an
+// increment is corrected by the next one.
+#define HEALTH_MAGIC 0x4846
+typedef struct {
+    uint16_t count[MIDIFOOT_HEALTH_COUNT];
+    uint32_t waitTicks;
+    uint16_t magic;             // valid, not erased or random after power on
+} health_t;
+health_t health __attribute__((section(".noinit")));
+health_t healthSaved EEMEM;
+uint8_t healthSavePos = sizeof(health_t); // next byte to save, sizeof when done
+uint8_t healthDirty = 0;        // changed since the last save
+uint16_t healthSeconds = 0;     // since the last save, 1024 ticks each
+
+void healthCount(uint8_t i)
+{
+    if (health.count[i] != 0xffff) health.count[i]++;
+    healthDirty = 1;
+}
+
+void healthSave(void)
+{
+    healthSavePos = 0;
+    healthDirty = 0;
+    healthSeconds = 0;
+}
+
+// write the next byte of a save, the EEPROM takes 3.4 ms per byte and
+// this doesn't wait for it
+void healthPoll(void)
+{
+    if (healthSavePos < sizeof(health) && eeprom_is_ready())
+    {
+        eeprom_update_byte((uint8_t *)&healthSaved + healthSavePos,
+            ((uint8_t *)&health)[healthSavePos]);
+        healthSavePos++;
+    }
+}
+
+// restore the counters unless they survived in RAM, then count the reset
+void healthInit(uint8_t mcusr)
+{
+    if ((mcusr & (1 << PORF)) || health.magic != HEALTH_MAGIC)
+    {
+        eeprom_read_block(&health, &healthSaved, sizeof(health));
+        if (health.magic != HEALTH_MAGIC)
+        {
+            memset(&health, 0, sizeof(health));
+            health.magic = HEALTH_MAGIC;
+        }
+    }
+    if (mcusr & (1 << PORF)) healthCount(MIDIFOOT_HEALTH_POWER_ON);
+    else
+    {
+        if (mcusr & (1 << EXTRF)) healthCount(MIDIFOOT_HEALTH_EXTERNAL);
+        if (mcusr & (1 << WDRF)) healthCount(MIDIFOOT_HEALTH_WATCHDOG);
+        if (mcusr & (1 << BORF)) healthCount(MIDIFOOT_HEALTH_BROWN_OUT);
+    }
+    healthSave();
+}
+#endif
+
+#if MIDIFOOT_DIN_OUT
+// 31250 baud MIDI out on MIDIFOOT_DIN_PIN, see midifootconfig.h. The main
+// loop fills a ring of bytes, the timer0 compare A interrupt sends them.
+#define DIN_COUNTS ((F_CPU / 64 + 15625) / 31250)  // timer0 counts per bit
+#define DIN_QUEUE_MASK (MIDIFOOT_DIN_QUEUE_LEN - 1)
+uchar dinQueue[MIDIFOOT_DIN_QUEUE_LEN];
+uint8_t dinHead = 0;            // next free byte, written by the main loop
+volatile uint8_t dinTail = 0;   // next byte to send, written by the interrupt
+uint16_t dinShift = 0;          // rest of the byte being sent, next bit first
+uint8_t dinLevel = 1;           // pin level at the next compare match
+uint8_t dinStatus = 0;          // last channel status sent, for running status
+#if MIDIFOOT_HEALTH
+volatile uint8_t dinLate = 0;   // late bits, added to the health counters each tick
+#endif
+uint8_t dinArmed = 0;           // an IN packet is armed, see dinPoll()
+uint8_t dinInWait = 0;          // ticks it has waited
+uint8_t dinInAge = 255;         // ticks since the host picked one up
+uint8_t dinOutAge = 255;        // ticks since an OUT packet came
+uint16_t dinOutPhase = 0;       // 8 us units since then, modulo the OUT interval
+
+// MIDI bytes in a USB-MIDI packet by code index number
+const static PROGMEM uchar cinLength[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+
+// queue the MIDI bytes of a USB-MIDI packet, all of them or none, and
+// only if keep bytes are left free after them
+uint8_t dinPush(const uchar *pkt, uint8_t keep)
+{
+    uint8_t len = pgm_read_byte(&cinLength[pkt[0] & 15]);
+    const uchar *p = pkt + 1;
+    if (len && dinStatus && *p == dinStatus)
+    {
+        p++;
+        len--;
+    }
+    if (len + keep > ((dinTail - dinHead - 1) & DIN_QUEUE_MASK)) return 0;
+    if (pkt[1] >= 0x80 && pkt[1] < 0xf0) dinStatus = pkt[1];
+    else if (pkt[1] >= 0xf0 && pkt[1] < 0xf8) dinStatus = 0; // system common cancels it
+    while (len--)
+    {
+        dinQueue[dinHead] = *p++;
+        dinHead = (dinHead + 1) & DIN_QUEUE_MASK;
+    }
+    return 1;
+}
+
+#if MIDIFOOT_DIN_THRU
+// The local events leave DIN_THRU_PACKET bytes of the DIN queue free, the
+// MIDI bytes of one OUT packet (two messages), so a packet the driver has
+// taken always fits, and when the queue is full the button's events are
+// the ones dropped. OUT packets are NAKed while less than DIN_THRU_ROOM is
+// free. Once requests are enabled again a packet can come any time within
+// the OUT interval, and the queue may not drain at all in that time (the
+// gaps, see dinPoll()), so the room above the packet is what the button
+// sends in one interval of at most 10 ms, taken as one press and one
+// release. These send a message each, except that with speculative taps
+// the release sends the tap and the next press the revert and the double
+// tap. Messages take 3 bytes, as the thru messages break the running status.
+#define DIN_THRU_PACKET 6
+#if MIDIFOOT_GESTURES && MIDIFOOT_SPECULATIVE_TAP
+#define DIN_LOCAL_MESSAGES 3
+#else
+#define DIN_LOCAL_MESSAGES 2
+#endif
+#define DIN_THRU_ROOM (DIN_THRU_PACKET + 3 * DIN_LOCAL_MESSAGES)
+
+uint8_t dinRoom(void)
+{
+    return (dinTail - dinHead - 1) & DIN_QUEUE_MASK;
+}
+#else
+#define DIN_THRU_PACKET 0
+#endif
+
+// start the interrupt if bytes are waiting, it stops itself when it runs
+// out or the gap closes. Called every loop pass in a gap, which also
+// catches bytes queued just as it stopped.
+void dinStart(void)
+{
+    if (dinTail == dinHead || (TIMSK & (1 << OCIE0A))) return;
+    cli();
+    OCR0A = TCNT0 + 2;
+    TIFR = 1 << OCF0A;
+    TIMSK |= 1 << OCIE0A;
+    sei();
+}
+#endif
+
+// queue a packet for sending, it is dropped if the queue is full
+void eventPush(const uchar *pkt)
+{
+#if MIDIFOOT_DIN_OUT
+    if (!dinPush(pkt, DIN_THRU_PACKET)) // independent of the USB queue, the host may not be polling
+    {
+#if MIDIFOOT_HEALTH
+        healthCount(MIDIFOOT_HEALTH_DIN_DROPPED);
+#endif
+    }
+#endif
+    uint8_t next = (eventHead + 1) & (EVENT_QUEUE_LEN - 1);
+    if (next == eventTail)
+    {
+        TRACE(MIDIFOOT_TRACE_DROP, pkt, 4);
+#if MIDIFOOT_HEALTH
+        healthCount(MIDIFOOT_HEALTH_DROPPED);
+#endif
+        return;
+    }
+    TRACE(MIDIFOOT_TRACE_EVENT, pkt, 4);
+    memcpy(eventQueue[eventHead], pkt, 4);
+#if MIDIFOOT_LATENCY_STATS
+    queueOrigin[eventHead] = eventOrigin;
+    queuePushed[eventHead] = timeNow();
+#endif
+    eventHead = next;
+    VCD_QUEUE();
+}
+
+// hand the oldest one or two queued packets to the driver, a low speed
+// interrupt transfer holds up to 8 bytes
+void eventSend(void)
+{
+    uchar buf[8];
+    uint8_t len = 0;
+#if MIDIFOOT_LATENCY_STATS
+    armTime = timeNow();
+    armOrigin = queueOrigin[eventTail];
+    armed = 1;
+#endif
+    while (eventTail != eventHead && len < 8)
+    {
+#if MIDIFOOT_LATENCY_STATS
+        statAdd(&latency[MIDIFOOT_LATENCY_QUEUE], armTime - queuePushed[eventTail]);
+#endif
+        memcpy(buf + len, eventQueue[eventTail], 4);
+        eventTail = (eventTail + 1) & (EVENT_QUEUE_LEN - 1);
+        len += 4;
+    }
+    VCD_QUEUE();
+    usbSetInterrupt(buf, len);
+#if MIDIFOOT_DIN_OUT
+    dinArmed = 1;
+    dinInWait = 0;
+#endif
+}
+
+#define LFSR_TAPS 0xb400
+
+// number of steps, 0 for the LFSR which steps through its states instead
+uint16_t patternLength(const uchar *pat)
+{
+    uint8_t count = pgm_read_byte(pat + 3);
+    if (count) return count;
+    switch (pgm_read_byte(pat + 4))
+    {
+    case KIND_BITREV:
+        return 1U << pgm_read_byte(pat + 5);
+    case KIND_EUCLID:
+        return pgm_read_byte(pat + 5);
+    }
+    return 0;
+}
+
+uint16_t patternNext(const uchar *pat, uint16_t step)
+{
+    if (!patternLength(pat)) // LFSR, a state of 0 would stick
+    {
+        if (!step) return 0xace1;
+        return (step >> 1) ^ ((step & 1) ? LFSR_TAPS : 0);
+    }
+    if (++step >= patternLength(pat)) step = 0;
+    return step;
+}
+
+uint16_t patternPrev(const uchar *pat, uint16_t step)
+{
+    if (!patternLength(pat))
+    {
+        if (step & 0x8000) return ((step ^ LFSR_TAPS) << 1) | 1;
+        return step << 1;
+    }
+    if (!step) step = patternLength(pat);
+    return step - 1;
+}
+
+uchar patternValue(const uchar *pat, uint16_t step)
+{
+    if (pgm_read_byte(pat + 3)) return pgm_read_byte(pat + 4 + step);
+    const uchar *p = pat + 5;
+    uint8_t lo, top;
+    switch (pgm_read_byte(pat + 4))
+    {
+    case KIND_BITREV:
+    {
+        uint8_t bits = pgm_read_byte(p++);
+        uint16_t rev = 0;
+        step ^= 1;              // even steps to the upper half
+        for (uint8_t i = bits; i; i--)
+        {
+            rev = (rev << 1) | (step & 1);
+            step >>= 1;
+        }
+        top = bits > 8 ? rev >> (bits - 8) : rev << (8 - bits);
+        break;
+    }
+    case KIND_EUCLID:
+    {
+        uint8_t n = pgm_read_byte(p);
+        uint8_t k = pgm_read_byte(p + 1);
+        return pgm_read_byte(p + ((step * k % n) < k ? 2 : 3));
+    }
+    default:                    // KIND_LFSR
+        top = step ^ (step >> 8);
+        break;
+    }
+    lo = pgm_read_byte(p);
+    return lo + (((uint16_t)top * (uint16_t)(pgm_read_byte(p + 1) - lo + 1)) >> 8); // top/256 of lo-hi
+}
+
+// expand one step of a pattern into a packet and queue it
+void patternPush(const uchar *pat, uint16_t step)
+{
+    uchar pkt[4];
+    memcpy_P(pkt, pat, 3);
+    pkt[3] = patternValue(pat, step);
+    eventPush(pkt);
+}
+
+#if MIDIFOOT_GESTURES
+// each gesture steps through its own bank of messages
+const static PROGMEM uchar doubleTapPattern[] = {
+    0x0B, 0xBE, 0x41,   // ch15 cc65 (portamento)
+    2,
+    127, 0,             // on, off
+};
+const static PROGMEM uchar longPressPattern[] = {
+    0x0B, 0xBE, 0x42,   // ch15 cc66 (sostenuto)
+    2,
+    127, 0,             // on, off
+};
+const static PROGMEM uchar holdPattern[] = {
+    0x0B, 0xBE, 0x43,   // ch15 cc67 (soft pedal)
+    1,
+    127,
+};
+
+// with MIDIFOOT_SPECULATIVE_TAP a single tap is sent right away, and a
+// gesture that turns out to have been meant instead compensates for it
+enum {
+    COMP_NONE,          // let the single tap stand
+    COMP_REVERT,        // step the tap bank back and resend its previous message
+};
+
+typedef struct {
+    const uchar *pat;           // pattern in flash
+    uint16_t step;              // next step to send
+    uint8_t comp;               // what to do about a speculative single tap
+} bank_t;
+
+enum { GESTURE_TAP, GESTURE_DOUBLE_TAP, GESTURE_LONG_PRESS, GESTURE_HOLD, GESTURE_COUNT };
+
+bank_t banks[GESTURE_COUNT] = {
+    {midiPattern, 0, COMP_NONE},        // single tap steps through the pattern like a toggle
+    {doubleTapPattern, 0, COMP_REVERT}, // toggle back before the double tap
+    {longPressPattern, 0, COMP_NONE},
+    {holdPattern, 0, COMP_NONE},
+};
+
+void bankSend(uint8_t gesture)
+{
+    bank_t *b = &banks[gesture];
+    TRACE(MIDIFOOT_TRACE_GESTURE, &gesture, 1);
+    patternPush(b->pat, b->step);
+    b->step = patternNext(b->pat, b->step);
+}
+
+#if MIDIFOOT_SPECULATIVE_TAP
+// gesture was recognized after a single tap had already been sent
+void bankCompensate(uint8_t gesture)
+{
+    bank_t *b = &banks[GESTURE_TAP];
+    if (banks[gesture].comp == COMP_REVERT)
+    {
+        b->step = patternPrev(b->pat, b->step);
+        patternPush(b->pat, patternPrev(b->pat, b->step));
+    }
+}
+#endif
+
+#define MS_TO_TICKS(ms) ((uint16_t)(((ms) * 1000L + 1023) / 1024))
+
+enum {
+    GS_IDLE,            // button up, nothing pending
+    GS_PRESSED,         // first press, long press not reached yet
+    GS_RELEASED,        // tapped once, waiting for a second tap
+    GS_HELD,            // long press sent, repeating holds
+    GS_WAIT_RELEASE,    // gesture sent, ignore the button until released
 };
-#define MSG_COUNT 16
-uint8_t msgNum = 0;
-uint8_t lastReading = 1;
-uint8_t buttonState = 1;
-uint8_t buttonChanged = 0;
+uint8_t gestureState = GS_IDLE;
+uint16_t gestureTime;           // ticks at the last transition or repeat
+uint16_t gestureWait;           // ticks from there to the next hold
+
+// classify debounced button changes into gestures
+void gestureButton(void)
+{
+    uint8_t pressed = !buttonState;
+    switch (gestureState)
+    {
+    case GS_IDLE:
+        if (pressed) gestureState = GS_PRESSED;
+        break;
+    case GS_PRESSED:
+        if (pressed) break;
+        if (MIDIFOOT_DOUBLE_TAP_MS)
+        {
+            if (MIDIFOOT_SPECULATIVE_TAP) bankSend(GESTURE_TAP);
+            gestureState = GS_RELEASED;
+            break;
+        }
+        bankSend(GESTURE_TAP);
+        gestureState = GS_IDLE;
+        break;
+    case GS_RELEASED:
+        if (!pressed) break;
+#if MIDIFOOT_SPECULATIVE_TAP
+        bankCompensate(GESTURE_DOUBLE_TAP);
+#endif
+        bankSend(GESTURE_DOUBLE_TAP);
+        gestureState = GS_WAIT_RELEASE;
+        break;
+    default:
+        if (!pressed) gestureState = GS_IDLE;
+        break;
+    }
+    gestureTime = ticks;
+}
+
+// time out the gesture windows, called once per tick
+void gestureTick(void)
+{
+    uint16_t elapsed = ticks - gestureTime;
+    switch (gestureState)
+    {
+    case GS_PRESSED:
+        if (elapsed < MS_TO_TICKS(MIDIFOOT_LONG_PRESS_MS)) break;
+        bankSend(GESTURE_LONG_PRESS);
+        gestureState = GS_HELD;
+        // first hold goes out MIDIFOOT_HOLD_MS after the press
+        gestureTime = ticks;
+        gestureWait = MS_TO_TICKS(MIDIFOOT_HOLD_MS - MIDIFOOT_LONG_PRESS_MS);
+        break;
+    case GS_RELEASED:
+        if (elapsed < MS_TO_TICKS(MIDIFOOT_DOUBLE_TAP_MS)) break;
+        if (!MIDIFOOT_SPECULATIVE_TAP) bankSend(GESTURE_TAP);
+        gestureState = GS_IDLE;
+        break;
+    case GS_HELD:
+        if (elapsed < gestureWait) break;
+        bankSend(GESTURE_HOLD);
+        gestureTime = ticks;
+        gestureWait = MS_TO_TICKS(MIDIFOOT_REPEAT_MS);
+        break;
+    }
+}
+#else
+// press and release step through the pattern, presses on even steps and
+// releases on odd ones
+void buttonSend(void)
+{
+    if ((msgNum % 2) && !buttonState) msgNum = patternNext(midiPattern, msgNum);
+    else if (!(msgNum % 2) && buttonState) msgNum = patternNext(midiPattern, msgNum);
+    patternPush(midiPattern, msgNum);
+    msgNum = patternNext(midiPattern, msgNum);
+    VCD(MIDIFOOT_VCD_MSGNUM, msgNum);
+}
+#endif
+
+// the pin change and timer0 interrupts wake the cpu from sleep and leave
+// a flag in GPIOR0 for the main loop, a single sbi that keeps them out of
+// V-USB's way
+#define FLAG_TICK 0     // timer0 overflowed (every 1.024 ms)
+#define FLAG_BUS 1      // pin change on D- or PB0: packet, keep-alive or resume
+#define FLAG_DIN 2      // DIN output interrupt running
+#define FLAG_LED 3      // LED lit, turned on at each timer0 overflow
+#define FLAG_GAP 4      // the DIN output may start a byte, see dinPoll()
+
+#ifndef MIDIFOOT_HOST         // the host build (host/mock.c) sets the flags itself
+ISR(PCINT0_vect, ISR_NAKED)
+{
+    asm volatile("sbi %0, %1" "\n\t" "reti" :: "I" (_SFR_IO_ADDR(GPIOR0)), "I" (FLAG_BUS));
+}
+
+ISR(TIMER0_OVF_vect, ISR_NAKED)
+{
+#if MIDIFOOT_LEDS
+    asm volatile("sbic %0, %1" "\n\t" "sbi %2, %3"
+        :: "I" (_SFR_IO_ADDR(GPIOR0)), "I" (FLAG_LED), "I" (_SFR_IO_ADDR(PORTB)), "I" (MIDIFOOT_LED_PIN));
+#endif
+    asm volatile("sbi %0, %1" "\n\t" "reti" :: "I" (_SFR_IO_ADDR(GPIOR0)), "I" (FLAG_TICK));
+}
+
+#if MIDIFOOT_LEDS
+ISR(TIMER0_COMPB_vect, ISR_NAKED)
+{
+    asm volatile("cbi %0, %1" "\n\t" "reti" :: "I" (_SFR_IO_ADDR(PORTB)), "I" (MIDIFOOT_LED_PIN));
+}
+#endif
+#endif
+
+#if MIDIFOOT_DIN_OUT
+// one bit of DIN output per compare match. The level was worked out at the
+// previous match, but the driver's interrupt keeps the match waiting for a
+// whole USB transaction: 36 us for an IN token it NAKs, around 100 us for a
+// packet. An edge more than half a bit (16 us) late is read wrong, and when
+// the next match has passed too, the rest of the byte comes 1 ms later. So
+// bytes only start in the gaps between transactions, see dinPoll().
+// Interrupts are enabled first, so we may be interrupted by ourselves when
+// the driver held us up for a whole bit; that bit is lost anyway.
+#ifdef MIDIFOOT_HOST
+void dinInterrupt(void)         // called by host/hostsim.c at each match
+#else
+ISR(TIMER0_COMPA_vect, ISR_NOBLOCK)
+#endif
+{
+#if MIDIFOOT_HEALTH
+    uint8_t late = TCNT0 - OCR0A;   // counts since the match
+#endif
+    OCR0A += DIN_COUNTS;
+    if (GPIOR0 & (1 << FLAG_DIN)) return;
+    GPIOR0 |= 1 << FLAG_DIN;
+    if (dinLevel) PORTB |= 1 << MIDIFOOT_DIN_PIN;
+    else PORTB &= ~(1 << MIDIFOOT_DIN_PIN);
+#if MIDIFOOT_HEALTH
+    if (late >= DIN_COUNTS / 2 && dinLate != 255) dinLate++;
+#endif
+    if (!dinShift)              // stop bit written
+    {
+        if (dinTail == dinHead || !(GPIOR0 & (1 << FLAG_GAP)))
+        {
+            TIMSK &= ~(1 << OCIE0A);
+            GPIOR0 &= ~(1 << FLAG_DIN);
+            return;
+        }
+        dinShift = 0x200 | dinQueue[dinTail] << 1;   // start bit, 8 data bits, stop bit
+        dinTail = (dinTail + 1) & DIN_QUEUE_MASK;
+    }
+    dinLevel = dinShift & 1;
+    dinShift >>= 1;
+    GPIOR0 &= ~(1 << FLAG_DIN);
+}
+
+// The host polls each endpoint at most every 8 ms (Linux rounds a bInterval
+// of 10 down to a power of two), and the main loop sees the transactions
+// that move data: an armed IN packet picked up, an OUT packet arriving.
+// Bytes start in the DIN_GAP ticks after one of these on each endpoint,
+// and the last one ends before the next poll. NAKed IN tokens can't be
+// seen, so while bytes wait with no event to send an empty packet is armed
+// to find the next poll. NAKed OUT packets (flow control) can't be seen
+// either, they are expected every MIDIFOOT_OUT_INTERVAL from the last one
+// that came, which goes wrong when the host polls at another interval.
+// An endpoint that isn't polled leaves the gap open: the host hasn't
+// configured the device, or an armed packet has waited for longer than the
+// poll interval, or no OUT packet came for that long. At an OUT interval
+// below 4 ms no gap fits, and OUT transactions aren't avoided.
+#define DIN_GAP 6               // ticks, the last byte ends 6.5 ms after the transaction
+#define DIN_IN_IDLE 12          // ticks, more than the IN endpoint's 10 ms
+#define DIN_OUT_IDLE (DIN_OUT_GAP + MIDIFOOT_OUT_INTERVAL + 2)
+#if MIDIFOOT_OUT_INTERVAL >= 8
+#define DIN_OUT_GAP DIN_GAP
+#else
+#define DIN_OUT_GAP (DIN_GAP - 4)   // 2.5 ms, polls come every 4 ms
+#endif
+
+void dinPoll(void)
+{
+    if (dinArmed && usbInterruptIsReady())
+    {
+        dinArmed = 0;
+        dinInAge = 0;
+    }
+    uint8_t gap = !usbConfiguration || dinInAge < DIN_GAP
+        || (dinArmed && dinInWait >= DIN_IN_IDLE);
+#if MIDIFOOT_DIN_THRU && MIDIFOOT_OUT_INTERVAL >= 4
+    // a tick is 128 phase units, and the first tick of an expected period
+    // may still come before its packet
+    if ((dinOutAge < DIN_OUT_IDLE || usbAllRequestsAreDisabled())
+        && (dinOutPhase >= DIN_OUT_GAP * 128
+            || (dinOutAge >= DIN_OUT_GAP && dinOutPhase < 128))) gap = 0;
+#endif
+    if (!gap)
+    {
+        GPIOR0 &= ~(1 << FLAG_GAP);
+        if (dinTail != dinHead && dinInAge >= DIN_GAP && eventTail == eventHead
+            && usbInterruptIsReady())
+        {
+            usbSetInterrupt(dinQueue, 0);   // empty, finds the next IN token
+            dinArmed = 1;
+            dinInWait = 0;
+        }
+        return;
+    }
+    GPIOR0 |= 1 << FLAG_GAP;
+    dinStart();
+}
+
+void dinTick(void)
+{
+    if (dinArmed && dinInWait != 255) dinInWait++;
+    if (dinInAge != 255) dinInAge++;
+    if (dinOutAge != 255) dinOutAge++;
+    dinOutPhase += 128;
+    if (dinOutPhase >= MIDIFOOT_OUT_INTERVAL * 125) dinOutPhase -= MIDIFOOT_OUT_INTERVAL * 125;
+#if MIDIFOOT_HEALTH
+    cli();
+    uint8_t late = dinLate;
+    dinLate = 0;
+    sei();
+    while (late--) healthCount(MIDIFOOT_HEALTH_DIN_LATE);
+#endif
+}
+#endif
+
+#if MIDIFOOT_LEDS
+#if MIDIFOOT_DIN_OUT && MIDIFOOT_LED_PIN == MIDIFOOT_DIN_PIN
+#error "the LED and the DIN output need different pins"
+#endif
+// LED feedback, see midifootconfig.h. The blink pattern has a bit for each
+// of 8 steps of 128 ticks, first step in the high bit.
+const static PROGMEM uchar ledPatterns[8] = {
+    0xff,           // 0-15: steady
+    0xf0,           // 16-31: slow blink, 1 Hz
+    0xcc,           // 32-47: blink, 2 Hz
+    0xaa,           // 48-63: fast blink, 4 Hz
+    0x80,           // 64-79: single flash
+    0xa0,           // 80-95: double flash
+    0xa8,           // 96-111: triple flash
+    0xfe,           // 112-127: on with a short break
+};
+uint8_t ledLevel = 0;           // 0 off, 255 on without PWM, else OCR0B
+uint8_t ledBlink = 0xff;
+
+// set the LED for the current blink step. Called at every step and when
+// the host changes it, the interrupts only see the flag and OCR0B.
+void ledUpdate(void)
+{
+    uint8_t level = ledBlink & (0x80 >> ((ticks >> 7) & 7)) ? ledLevel : 0;
+    GPIOR0 &= ~(1 << FLAG_LED);
+    cli();
+    TIMSK &= ~(1 << OCIE0B);
+    sei();
+    if (!level)
+    {
+        PORTB &= ~(1 << MIDIFOOT_LED_PIN);
+        return;
+    }
+    if (level == 255) PORTB |= 1 << MIDIFOOT_LED_PIN;
+    else
+    {
+        OCR0B = level;
+        TIFR = 1 << OCF0B;
+        cli();
+        TIMSK |= 1 << OCIE0B;
+        sei();
+    }
+    GPIOR0 |= 1 << FLAG_LED;
+}
+
+// a USB-MIDI packet from the host
+void ledMidi(const uchar *pkt)
+{
+    if (pkt[1] != 0xb0 + MIDIFOOT_LED_CHANNEL - 1) return;
+    if (pkt[2] == MIDIFOOT_LED_CC_LEVEL) ledLevel = pkt[3] >= 127 ? 255 : (pkt[3] * pkt[3] + 63) >> 6;
+    else if (pkt[2] == MIDIFOOT_LED_CC_BLINK) ledBlink = pgm_read_byte(&ledPatterns[(pkt[3] >> 4) & 7]);
+    else return;
+    ledUpdate();
+}
+#endif
+
+#if USB_CFG_IMPLEMENT_FN_WRITEOUT
+// called by the driver from usbPoll() with the host's packets for the MIDI
+// OUT endpoint. With MIDIFOOT_DIN_THRU it is only enabled while they fit
+// into the DIN queue.
+void usbFunctionWriteOut(uchar *data, uchar len)
+{
+#if MIDIFOOT_DIN_THRU
+    dinOutAge = 0;
+    dinOutPhase = 0;
+#endif
+    for (uint8_t i = 0; i + 4 <= len; i += 4)
+    {
+#if MIDIFOOT_LEDS
+        ledMidi(data + i);
+#endif
+#if MIDIFOOT_DIN_THRU
+        if (!dinPush(data + i, 0))
+        {
+#if MIDIFOOT_HEALTH
+            healthCount(MIDIFOOT_HEALTH_DIN_DROPPED);
+#endif
+        }
+#endif
+    }
+#if MIDIFOOT_DIN_THRU
+    if (dinRoom() < DIN_THRU_ROOM) usbDisableAllRequests(); // NAK until there is room again
+#endif
+}
+#endif
+
+#if HAVE_STATS || MIDIFOOT_TRACE
+// time in timer0 counts (64 cycles), wraps after 256 ticks (262 ms)
+uint16_t timeNow(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t t = TCNT0;
+    uint8_t hi = ticks;
+    if (GPIOR0 & (1 << FLAG_TICK)) hi++;            // not counted by main() yet
+    if ((TIFR & (1 << TOV0)) && t < 128) hi++;      // overflow interrupt pending
+    SREG = sreg;
+    return (hi << 8) | t;
+}
+#endif
+
+#if MIDIFOOT_MEMORY_STATS
+// the free RAM between the static data and the stack is filled with a
+// pattern before anything runs, whatever is left of it was never used
+#define STACK_PAINT 0xc5
+uint16_t memoryReport[3];
+
+#ifdef MIDIFOOT_HOST
+// the host build paints an image of the chip's RAM from <avr/io.h> before
+// main(), and host/mock.c uses the top of it as the stack
+#define __data_start hostRam[0]
+#define _end hostRam[hostRamEnd]
+#define __stack hostRam[RAMEND - RAMSTART]
+
+void stackPaint(void) __attribute__((constructor));
+void stackPaint(void)
+{
+    for (uint8_t *p = &_end; p <= &__stack; p++) *p = STACK_PAINT;
+}
+#else
+extern uint8_t __data_start, _end, __stack; // from the linker script
+
+void stackPaint(void) __attribute__((naked, used, section(".init1")));
+void stackPaint(void)
+{
+    // no C here, r1 is not cleared before .init2
+    asm volatile(
+        "    ldi r30, lo8(_end)"        "\n\t"
+        "    ldi r31, hi8(_end)"        "\n\t"
+        "    ldi r24, %0"               "\n\t"
+        "    ldi r25, hi8(__stack)"     "\n\t"
+        "    rjmp 2f"                   "\n\t"
+        "1:  st Z+, r24"                "\n\t"
+        "2:  cpi r30, lo8(__stack)"     "\n\t"
+        "    cpc r31, r25"              "\n\t"
+        "    brlo 1b"                   "\n\t"
+        "    breq 1b"
+        :: "M" (STACK_PAINT));
+}
+#endif
+
+void memoryUpdate(void)
+{
+    uint8_t *p = &_end;
+    while (p <= &__stack && *p == STACK_PAINT) p++;
+    memoryReport[0] = &_end - &__data_start;    // .data and .bss
+    memoryReport[1] = &__stack + 1 - p;         // deepest stack so far
+    memoryReport[2] = p - &_end;                // never touched
+}
+#endif
+
+#if MIDIFOOT_USB_SUSPEND
+#define SUSPEND_TICKS ((MIDIFOOT_SUSPEND_MS * 1000L + 1023) / 1024)
+uint8_t idleTicks = 0;
+
+#if MIDIFOOT_REMOTE_WAKEUP
+uchar remoteWakeup = 0;
+
+// called by the driver for every setup packet, see usbconfig.h
+void usbSetupHook(uchar *data)
+{
+    usbRequest_t *rq = (void *)data;
+    if (rq->bmRequestType == (USBRQ_TYPE_STANDARD | USBRQ_RCPT_DEVICE)
+        && rq->wValue.bytes[0] == 1) // DEVICE_REMOTE_WAKEUP feature selector
+    {
+        if (rq->bRequest == USBRQ_SET_FEATURE) remoteWakeup = 1;
+        else if (rq->bRequest == USBRQ_CLEAR_FEATURE) remoteWakeup = 0;
+    }
+}
+#endif
+
+// power down until D- changes (host resume or bus reset) or the button
+// is pressed, then wake the host if it allowed us to
+void usbSuspend(void)
+{
+    TRACE(MIDIFOOT_TRACE_SUSPEND, 0, 0);
+#if MIDIFOOT_HEALTH
+    if (healthDirty) healthSave();
+    while (healthSavePos < sizeof(health)) healthPoll(); // before the clock stops
+#endif
+#if MIDIFOOT_DIN_OUT
+    while (TIMSK & (1 << OCIE0A));  // finish sending, timer0 stops too
+#endif
+#if MIDIFOOT_SERIAL
+    while (serialSavePos < sizeof(serialId)) serialPoll();
+#endif
+#if MIDIFOOT_LEDS
+    GPIOR0 &= ~(1 << FLAG_LED); // dark while suspended, the bus allows 2.5 mA
+    PORTB &= ~(1 << MIDIFOOT_LED_PIN);
+#endif
+    wdt_disable();              // would reset us after 500 ms
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli();
+    sleep_enable();
+#if defined(BODS)
+    sleep_bod_disable();
+#endif
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+#if MIDIFOOT_REMOTE_WAKEUP
+    if (remoteWakeup && !(PINB & (1 << PB0))
+        && (USBIN & USBMASK) == (1 << USB_CFG_DMINUS_BIT)) // bus still idle (J)
+    {
+        _delay_ms(5);           // bus must be idle for 5 ms before we signal
+        cli();
+        USBOUT = (USBOUT & ~USBMASK) | (1 << USB_CFG_DPLUS_BIT);
+        USBDDR |= USBMASK;      // drive K state
+        _delay_ms(10);
+        USBDDR &= ~USBMASK;     // release the bus, the host keeps up the resume
+        USBOUT &= ~USBMASK;
+        USB_INTR_PENDING = 1 << USB_INTR_PENDING_BIT; // our own K was no packet
+        sei();
+        TRACE(MIDIFOOT_TRACE_WAKEUP, 0, 0);
+    }
+#endif
+    wdt_enable(WDTO_500MS);
+#if MIDIFOOT_LEDS
+    ledUpdate();
+#endif
+    TRACE(MIDIFOOT_TRACE_RESUME, 0, 0);
+}
+#endif
+
+#if MIDIFOOT_REMOTE_WAKEUP || MIDIFOOT_HEALTH
+// called by the driver when a bus reset starts, see usbconfig.h
+void usbResetHook(void)
+{
+#if MIDIFOOT_USB_SUSPEND && MIDIFOOT_REMOTE_WAKEUP
+    remoteWakeup = 0;
+#endif
+#if MIDIFOOT_HEALTH
+    healthCount(MIDIFOOT_HEALTH_BUS_RESET);
+#endif
+}
+#endif
+
+// vendor requests, see requests.h
+usbMsgLen_t usbFunctionSetup(uchar data[8])
+{
+    usbRequest_t *rq = (void *)data;
+    if ((rq->bmRequestType & USBRQ_TYPE_MASK) != USBRQ_TYPE_VENDOR) return 0;
+    switch (rq->bRequest)
+    {
+#if MIDIFOOT_LATENCY_STATS
+    case MIDIFOOT_RQ_GET_LATENCY:
+        usbMsgPtr = (uchar *) latency;
+        return sizeof(latency);
+    case MIDIFOOT_RQ_RESET_LATENCY:
+        statReset(latency, MIDIFOOT_LATENCY_COUNT);
+        break;
+#endif
+#if MIDIFOOT_MEMORY_STATS
+    case MIDIFOOT_RQ_GET_MEMORY:
+        memoryUpdate();
+        usbMsgPtr = (uchar *) memoryReport;
+        return sizeof(memoryReport);
+#endif
+#if MIDIFOOT_TRACE
+    case MIDIFOOT_RQ_GET_TRACE:
+        traceReadStart(rq->wLength.word);
+        return USB_NO_MSG;      // reply comes from usbFunctionRead()
+#endif
+#if MIDIFOOT_HEALTH
+    case MIDIFOOT_RQ_GET_HEALTH:
+        usbMsgPtr = (uchar *) &health;
+        return sizeof(health.count) + sizeof(health.waitTicks);
+    case MIDIFOOT_RQ_RESET_HEALTH:
+        memset(&health, 0, sizeof(health.count) + sizeof(health.waitTicks));
+        healthSave();
+        break;
+#endif
+#if MIDIFOOT_LOOP_STATS
+    case MIDIFOOT_RQ_GET_LOOP:
+        usbMsgPtr = (uchar *) loopStats;
+        return sizeof(loopStats);
+    case MIDIFOOT_RQ_RESET_LOOP:
+        statReset(loopStats, MIDIFOOT_LOOP_COUNT);
+        break;
+#endif
+#if MIDIFOOT_SERIAL
+    case MIDIFOOT_RQ_SET_SERIAL:
+        serialSet(rq->wValue.word | (uint32_t)rq->wIndex.word << 16);
+        serialSavePos = 0;
+        break;
+#endif
+    }
+    return 0;
+}
 
 int main(void)
 {
+#if MIDIFOOT_TRACE || MIDIFOOT_HEALTH
+    uchar resetCause = MCUSR;
+#endif
     MCUSR = 0;
     wdt_disable();
+#if MIDIFOOT_HEALTH
+    healthInit(resetCause);
+#endif
+#if MIDIFOOT_SERIAL
+    serialInit();
+#endif
     usbInit();
+    TRACE(MIDIFOOT_TRACE_RESET, &resetCause, 1);
     usbDeviceDisconnect(); // enforce re-enumeration
     uint8_t i = 0;
     while(--i) // fake USB disconnect for > 250 ms
@@ -259,43 +1341,170 @@ int main(void)
 
     DDRB &= ~(1 << PB0);        // set PB0 as input (default)
     PORTB |= (1 << PB0);        // enable pullup on PB0
+#if MIDIFOOT_DIN_OUT
+    PORTB |= (1 << MIDIFOOT_DIN_PIN);   // DIN output idles high, no current in the loop
+    DDRB |= (1 << MIDIFOOT_DIN_PIN);
+#endif
+#if MIDIFOOT_LEDS
+    DDRB |= (1 << MIDIFOOT_LED_PIN); // LED off until the host sets it
+#endif
 
     TCCR1 |= (1 << CTC1);       // clear timer on compare match
     TCCR1 |= (1 << CS13);       // clock prescaler 128
     OCR1C = 5;                 // reset timer every 80 ms ([1 / (16E6 / 128)] * 5 = 40us)
-    
+
+    ACSR |= (1 << ACD);         // analog comparator off
+    power_adc_disable();
+    power_usi_disable();
+    GIMSK |= (1 << PCIE);       // wake from sleep on a pin change
+    PCMSK |= (1 << PCINT0);     // of PB0
+    PCMSK |= (1 << USB_CFG_DMINUS_BIT); // or D- (PCINT1), which changes with bus activity
+    TCCR0B |= (1 << CS01) | (1 << CS00); // timer0 prescaler 64, overflows every 1.024 ms
+    TIMSK |= (1 << TOIE0);      // wake at least that often to keep up usbPoll()
+    set_sleep_mode(SLEEP_MODE_IDLE);
+#if MIDIFOOT_LATENCY_STATS
+    statReset(latency, MIDIFOOT_LATENCY_COUNT);
+#endif
+#if MIDIFOOT_LOOP_STATS
+    statReset(loopStats, MIDIFOOT_LOOP_COUNT);
+#endif
+
     for(;;) // main event loop
     {
+#if MIDIFOOT_LOOP_STATS
+        uint16_t t = timeNow();
+        if (!loopSkip) statAdd(&loopStats[MIDIFOOT_LOOP_INTERVAL], t - loopStart);
+        loopSkip = 0;
+        loopStart = t;
+#endif
         wdt_reset(); // reset the watchdog timer
         usbPoll();
-        if (!buttonChanged)
+#if MIDIFOOT_LOOP_STATS
+        statAdd(&loopStats[MIDIFOOT_LOOP_POLL], timeNow() - loopStart);
+#endif
+        if (GPIOR0 & (1 << FLAG_TICK))
         {
-            buttonState = PINB & (1 << PB0);
-            if (buttonState != lastReading)
+            GPIOR0 &= ~(1 << FLAG_TICK);
+            ticks++;
+#if MIDIFOOT_LEDS
+            if (!(ticks & 127)) ledUpdate();    // next blink step
+#endif
+#if MIDIFOOT_DIN_OUT
+            dinTick();
+#endif
+#if MIDIFOOT_HEALTH
+            if (!usbInterruptIsReady()) // armed packet not picked up yet
             {
-                TCNT1 = 0x00;
-                TCCR1 &= ~(1 << CTC1);   // cancel timer restart on compare
-                lastReading = buttonState;
+                health.waitTicks++;
+                healthDirty = 1;
             }
-            if (TCNT1 > 25) // 200ms and no button change
+            if (!(ticks & 1023))
             {
-                TCNT1 = 0x00;
-                TCCR1 |= (1 << CTC1);    // restart timer if > 40ms
-                buttonChanged = 1;
+                if (healthSeconds < MIDIFOOT_HEALTH_SAVE_S) healthSeconds++;
+                else if (healthDirty) healthSave();
+            }
+#endif
+#if MIDIFOOT_USB_SUSPEND
+            // a resume or reset holds the bus out of the idle J state
+            if ((GPIOR0 & (1 << FLAG_BUS))
+                || (USBIN & USBMASK) != (1 << USB_CFG_DMINUS_BIT))
+            {
+                GPIOR0 &= ~(1 << FLAG_BUS);
+                idleTicks = 0;
+            }
+            else if (++idleTicks > SUSPEND_TICKS)
+            {
+                usbSuspend();
+                idleTicks = 0;
+#if MIDIFOOT_LOOP_STATS
+                loopSkip = 1;
+#endif
             }
+#endif
+#if MIDIFOOT_GESTURES
+#if MIDIFOOT_LATENCY_STATS
+            eventOrigin = timeNow();
+#endif
+            gestureTick();
+#endif
+        }
+        uint8_t reading = PINB & (1 << PB0);
+        if (reading != lastReading)
+        {
+#if MIDIFOOT_LATENCY_STATS
+            if (TCCR1 & (1 << CTC1)) eventEdge = timeNow(); // debounce not running yet
+#endif
+            TCNT1 = 0x00;
+            TCCR1 &= ~(1 << CTC1);   // cancel timer restart on compare
+            lastReading = reading;
+            VCD(MIDIFOOT_VCD_DEBOUNCE, 1);
         }
-        else
+        if (TCNT1 > 25) // 200ms and no button change
         {
-            if (usbInterruptIsReady())
+            TCNT1 = 0x00;
+            TCCR1 |= (1 << CTC1);    // restart timer if > 40ms
+            VCD(MIDIFOOT_VCD_DEBOUNCE, 0);
+            if (reading != buttonState)
             {
-                if ((msgNum % 2) && !buttonState) msgNum++;
-                else if (!(msgNum % 2) && buttonState) msgNum++;
-                usbSetInterrupt(midiPkt[msgNum], 4);
-                msgNum++;
-                if (msgNum >= MSG_COUNT) msgNum = 0;
-                buttonChanged = 0;
+                buttonState = reading;
+                TRACE(MIDIFOOT_TRACE_BUTTON, &buttonState, 1);
+                VCD(MIDIFOOT_VCD_BUTTON, buttonState != 0);
+#if MIDIFOOT_LATENCY_STATS
+                eventOrigin = eventEdge;
+                statAdd(&latency[MIDIFOOT_LATENCY_DEBOUNCE], timeNow() - eventEdge);
+#endif
+#if MIDIFOOT_GESTURES
+                gestureButton();
+#else
+                buttonSend();
+#endif
             }
         }
+#if MIDIFOOT_LATENCY_STATS
+        if (armed && usbInterruptIsReady()) // the driver sent the armed packet
+        {
+            uint16_t t = timeNow();
+            statAdd(&latency[MIDIFOOT_LATENCY_HOST], t - armTime);
+            statAdd(&latency[MIDIFOOT_LATENCY_TOTAL], t - armOrigin);
+            armed = 0;
+        }
+#endif
+        if (eventTail != eventHead && usbInterruptIsReady())
+        {
+            eventSend();
+        }
+#if MIDIFOOT_DIN_OUT
+        dinPoll();
+#endif
+#if MIDIFOOT_DIN_THRU
+        if (usbAllRequestsAreDisabled() && dinRoom() >= DIN_THRU_ROOM)
+        {
+            usbEnableAllRequests();
+            if (dinOutAge > DIN_OUT_GAP) dinOutAge = DIN_OUT_GAP;   // the NAKed packet comes again
+        }
+#endif
+#if MIDIFOOT_HEALTH
+        healthPoll();
+#endif
+#if MIDIFOOT_SERIAL
+        serialPoll();
+#endif
+#if MIDIFOOT_LOOP_STATS
+        statAdd(&loopStats[MIDIFOOT_LOOP_BUSY], timeNow() - loopStart);
+#endif
+        // idle until the next USB, pin change or timer0 interrupt, unless
+        // the debounce timer is running or a received packet awaits usbPoll().
+        // While the host is held off (usbRxLen < 0) the DIN output's bit
+        // interrupt wakes the loop to check for room.
+        cli();
+        if ((TCCR1 & (1 << CTC1)) && usbRxLen <= 0)
+        {
+            sleep_enable();
+            sei();              // sleep_cpu() executes before any interrupt
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
     }
     return 0;
 }
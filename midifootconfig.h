@@ -0,0 +1,269 @@
+/* Name: midifootconfig.h
+ * Project: Single button midi controller
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+#ifndef __midifootconfig_h_included__
+#define __midifootconfig_h_included__
+
+/* This file holds the compile time options of the MidiFoot firmware. Like
+ * usbconfig.h it only contains #defines, so it can be included from C and
+ * assembler alike. Any option can also be overridden from the make command
+ * line, e.g. "make DEFINES=-DMIDIFOOT_GESTURES=1".
+ */
+
+/* ---------------------------- Power Management --------------------------- */
+
+#ifndef MIDIFOOT_USB_SUSPEND
+#define MIDIFOOT_USB_SUSPEND            1
+#endif
+/* Define this to 1 to power down when the host suspends the bus. Suspend is
+ * detected when D- stops changing (no packets and no low speed keep-alives)
+ * for MIDIFOOT_SUSPEND_MS. In power down only a pin change on D- (resume or
+ * reset from the host) or on the button wakes the chip up again.
+ */
+#ifndef MIDIFOOT_SUSPEND_MS
+#define MIDIFOOT_SUSPEND_MS             4
+#endif
+/* Milliseconds of bus inactivity before the device suspends. The USB spec
+ * requires at least 3 ms, and suspend current must be reached within 10 ms.
+ */
+#ifndef MIDIFOOT_REMOTE_WAKEUP
+#define MIDIFOOT_REMOTE_WAKEUP          1
+#endif
+/* Define this to 1 to announce remote wakeup in the configuration descriptor.
+ * When the host has enabled it with SET_FEATURE, pressing the button while
+ * the bus is suspended wakes the host up. The press is sent as usual once
+ * the bus has resumed. Requires MIDIFOOT_USB_SUSPEND.
+ */
+
+/* ----------------------------- Identification ---------------------------- */
+
+#ifndef MIDIFOOT_SERIAL
+#define MIDIFOOT_SERIAL                 1
+#endif
+/* Define this to 1 to send a serial number string descriptor, so the host
+ * can tell identical MidiFoots apart and keep its mapping across replugs.
+ * The serial number is a 32 bit ID in EEPROM, sent as 8 hex digits. A new
+ * chip makes one up from watchdog oscillator jitter on its first start,
+ * which takes half a second longer. MIDIFOOT_RQ_SET_SERIAL assigns one
+ * (see requests.h and tools/mfctl.py).
+ */
+
+/* -------------------------------- Gestures ------------------------------- */
+
+#ifndef MIDIFOOT_GESTURES
+#define MIDIFOOT_GESTURES               0
+#endif
+/* Define this to 1 to classify presses into gestures instead of sending a
+ * message on every press and release. Each gesture steps through its own
+ * bank of messages (see banks[] in midifoot.c):
+ *   single tap:  press and release, no second press within the double tap
+ *                window. Steps through midiPattern like a toggle switch.
+ *   double tap:  second press within MIDIFOOT_DOUBLE_TAP_MS of a release.
+ *   long press:  held for MIDIFOOT_LONG_PRESS_MS.
+ *   hold:        held for MIDIFOOT_HOLD_MS, repeats every MIDIFOOT_REPEAT_MS
+ *                until released.
+ * Note that a single tap is only sent when the double tap window has passed,
+ * unless MIDIFOOT_SPECULATIVE_TAP is set. Set MIDIFOOT_DOUBLE_TAP_MS to 0 to
+ * disable double taps and send single taps on release.
+ */
+#ifndef MIDIFOOT_DOUBLE_TAP_MS
+#define MIDIFOOT_DOUBLE_TAP_MS          250
+#endif
+#ifndef MIDIFOOT_SPECULATIVE_TAP
+#define MIDIFOOT_SPECULATIVE_TAP        0
+#endif
+/* Define this to 1 to send a single tap as soon as the button is released
+ * instead of after the double tap window. If a second tap follows, the
+ * double tap bank's compensation rule (the comp field in banks[]) decides
+ * what happens to the tap that was already sent: COMP_NONE leaves it,
+ * COMP_REVERT steps the tap bank back and resends its previous message
+ * before the double tap message goes out.
+ */
+#ifndef MIDIFOOT_LONG_PRESS_MS
+#define MIDIFOOT_LONG_PRESS_MS          600
+#endif
+#ifndef MIDIFOOT_HOLD_MS
+#define MIDIFOOT_HOLD_MS                1200
+#endif
+#ifndef MIDIFOOT_REPEAT_MS
+#define MIDIFOOT_REPEAT_MS              200
+#endif
+/* Gesture windows in milliseconds. They are counted in 1.024 ms timer ticks,
+ * MIDIFOOT_HOLD_MS must not be less than MIDIFOOT_LONG_PRESS_MS.
+ */
+
+/* ---------------------------- DIN MIDI Output ---------------------------- */
+
+#ifndef MIDIFOOT_DIN_OUT
+#define MIDIFOOT_DIN_OUT                0
+#endif
+/* Define this to 1 to send every MIDI event out of a 5-pin DIN socket as
+ * well, at 31250 baud on MIDIFOOT_DIN_PIN (through 220 ohms to DIN pin 5,
+ * DIN pin 4 through 220 ohms to +5V). The ATtiny85 has no UART, so the
+ * timer0 compare A interrupt shifts out one bit per 32 us from a ring
+ * buffer. V-USB keeps interrupts off for a whole USB transaction, 36 to
+ * over 100 us, which would make bits late, so bytes only go out in the
+ * gaps between the host's polls. That costs throughput (about half of the
+ * 3125 bytes a second) and adds up to 10 ms of latency, and while bytes
+ * wait the device arms empty packets to find the next poll. Late bits
+ * still happen when the host doesn't poll at the endpoint intervals;
+ * "tools/mfctl.py health" counts them. Check a build with "make hostcheck",
+ * whose simulated MIDI receiver reports the messages it got wrong.
+ */
+#ifndef MIDIFOOT_DIN_PIN
+#define MIDIFOOT_DIN_PIN                5
+#endif
+/* Port B bit of the output. All pins of the board are in use: PB0 is the
+ * button, PB1 and PB2 are USB and PB3 and PB4 hold the crystal. PB5 can be
+ * used once it stops being the reset pin ("make fuse-din", after which the
+ * chip can only be reprogrammed with a high voltage programmer). Its drive
+ * is weaker than the other pins' but enough for the 5 mA of a MIDI loop.
+ */
+#ifndef MIDIFOOT_DIN_QUEUE_LEN
+#define MIDIFOOT_DIN_QUEUE_LEN          32
+#endif
+/* Bytes waiting to be sent, a power of 2 no larger than 128. Each one takes
+ * 320 us on the wire. Running status leaves out repeated status bytes.
+ */
+#ifndef MIDIFOOT_DIN_THRU
+#define MIDIFOOT_DIN_THRU               MIDIFOOT_DIN_OUT
+#endif
+/* Define this to 1 to forward what the host sends to the MIDI OUT endpoint
+ * (0x01) to the DIN output too, which makes the pedal a USB MIDI interface.
+ * While the DIN queue has no room for another packet the driver NAKs all
+ * OUT and SETUP packets (flow control), so the host waits instead of losing
+ * messages. Requires MIDIFOOT_DIN_OUT.
+ */
+#ifndef MIDIFOOT_OUT_INTERVAL
+#define MIDIFOOT_OUT_INTERVAL           10
+#endif
+/* Poll interval of the MIDI OUT endpoint in ms. A packet holds two
+ * messages, so at 10 ms, the least the USB spec allows at low speed, the
+ * host sends about 200 messages a second (Linux rounds it to 8 ms), a
+ * quarter of what the DIN line carries. Linux accepts smaller intervals as
+ * well, but below 4 ms the DIN output finds no gaps between the packets
+ * and gets a third or more of the messages wrong. It expects the NAKed
+ * packets of flow control at this interval, so set it to the one the host
+ * really uses (8 for Linux) when thru is busy.
+ */
+
+/* ------------------------------ LED Feedback ----------------------------- */
+
+#ifndef MIDIFOOT_LEDS
+#define MIDIFOOT_LEDS                   0
+#endif
+/* Define this to 1 to light an LED on MIDIFOOT_LED_PIN (through a resistor
+ * to ground) as the host tells it, so the performer can see a toggle's
+ * state or the pattern step. Control changes sent to the MIDI OUT endpoint
+ * on MIDIFOOT_LED_CHANNEL set its brightness and blink pattern. Timer0's
+ * PWM outputs are PB0 and PB1, the button and D-, so the brightness is
+ * timed by timer0 instead: its overflow interrupt turns the LED on and the
+ * compare B interrupt off again, each a single instruction.
+ */
+#ifndef MIDIFOOT_LED_PIN
+#define MIDIFOOT_LED_PIN                5
+#endif
+/* Port B bit of the LED. Like the DIN output it needs PB5 without its reset
+ * function ("make fuse-din"), so the two can't be used together on this
+ * board.
+ */
+#ifndef MIDIFOOT_LED_CHANNEL
+#define MIDIFOOT_LED_CHANNEL            15
+#endif
+#ifndef MIDIFOOT_LED_CC_LEVEL
+#define MIDIFOOT_LED_CC_LEVEL           80
+#endif
+#ifndef MIDIFOOT_LED_CC_BLINK
+#define MIDIFOOT_LED_CC_BLINK           81
+#endif
+/* MIDI channel (1-16) and controller numbers the LED listens to. The level
+ * is 0 (off) to 127 (fully on) with a square law so steps look even. The
+ * blink pattern is picked by the value in ranges of 16, see the README.
+ */
+
+/* ---------------------------- Instrumentation ---------------------------- */
+
+#ifndef MIDIFOOT_HEALTH
+#define MIDIFOOT_HEALTH                 0
+#endif
+/* Define this to 1 to count faults: resets by cause (power on, reset pin,
+ * watchdog, brown-out), USB bus resets, events dropped because the queue
+ * was full, and the time interrupt data waited for the host to poll. The
+ * counters survive watchdog and brown-out resets in RAM and are saved to
+ * EEPROM, so they also survive a power cycle. Read them with
+ * MIDIFOOT_RQ_GET_HEALTH (see requests.h and tools/mfctl.py). Off by
+ * default because of the EEPROM writes, "make instrumented" turns it on.
+ */
+#ifndef MIDIFOOT_HEALTH_SAVE_S
+#define MIDIFOOT_HEALTH_SAVE_S          300
+#endif
+/* Seconds between EEPROM saves of changed counters, which is how much may
+ * be lost on a power cycle. Counters are also saved on every reset and
+ * before the device suspends. Only bytes that changed are written, one per
+ * main loop pass, but each save wears the EEPROM (100000 cycles).
+ */
+
+#ifndef MIDIFOOT_LATENCY_STATS
+#define MIDIFOOT_LATENCY_STATS          0
+#endif
+/* Define this to 1 to time every event on its way through the firmware:
+ * first edge on PB0, debounce decision, queue push, usbSetInterrupt() and
+ * the main loop noticing that the driver sent the packet (it wakes up right
+ * after the IN token). Timestamps are timer0 counts, 64 cycles each. The
+ * statistics take about 130 bytes of RAM and are read with the vendor
+ * request MIDIFOOT_RQ_GET_LATENCY (see requests.h and tools/mfctl.py).
+ */
+#ifndef MIDIFOOT_LOOP_STATS
+#define MIDIFOOT_LOOP_STATS             0
+#endif
+/* Define this to 1 to time each main loop pass: the interval between calls
+ * of usbPoll() (V-USB wants one at least every 50 ms, plus one soon after
+ * each received packet), the time spent inside usbPoll() and the busy part
+ * of the pass before the cpu goes to sleep. The worst cases tell how much
+ * room is left for new work in the loop. Read with MIDIFOOT_RQ_GET_LOOP.
+ * "make instrumented" builds the firmware with all statistics enabled.
+ */
+#ifndef MIDIFOOT_MEMORY_STATS
+#define MIDIFOOT_MEMORY_STATS           0
+#endif
+/* Define this to 1 to fill the free RAM with a pattern at startup and report
+ * how much of it the stack has used so far with MIDIFOOT_RQ_GET_MEMORY. Of the
+ * 512 bytes, the driver's buffers and our queues and tables are static; run
+ * "make size" to see what takes the room.
+ */
+#ifndef MIDIFOOT_TRACE
+#define MIDIFOOT_TRACE                  0
+#endif
+/* Define this to 1 to log what happens into a ring buffer in RAM: button
+ * changes, queued and dropped events, suspend and resume, plus the driver's
+ * DBG1() output. Level 2 adds the driver's DBG2() dumps of every packet
+ * sent and received, which fills the buffer quickly. Unlike DEBUG_LEVEL,
+ * which prints through a UART (the ATtiny85 has none) and busy waits for
+ * every character, a record is a few stores and doesn't disturb USB timing.
+ * When the buffer is full the oldest records are dropped. The record format
+ * is described in requests.h.
+ */
+#ifndef MIDIFOOT_TRACE_LEN
+#define MIDIFOOT_TRACE_LEN              64
+#endif
+/* Size of the trace buffer in bytes, a power of 2 no larger than 128.
+ */
+#ifndef MIDIFOOT_VCD
+#define MIDIFOOT_VCD                    1
+#endif
+/* Define this to 0 to leave the trace points out of the host build, which
+ * writes them to a VCD file for GTKWave next to the pins it watches itself
+ * (make host SIMFLAGS="-o host.vcd"). The AVR build never has them. The
+ * signals:
+ */
+#define MIDIFOOT_VCD_BUTTON             0   /* buttonState, 0 = pressed */
+#define MIDIFOOT_VCD_DEBOUNCE           1   /* 1 while an edge is debounced */
+#define MIDIFOOT_VCD_MSGNUM             2   /* msgNum, the next pattern step */
+#define MIDIFOOT_VCD_QUEUE              3   /* events waiting in the queue */
+#define MIDIFOOT_VCD_COUNT              4
+
+#endif /* __midifootconfig_h_included__ */
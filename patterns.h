@@ -0,0 +1,38 @@
+/* Name: patterns.h
+ * Project: Single button midi controller
+ * Author: Bill Peterson
+ */
+
+/* This header is shared between the firmware and the host simulation. It
+ * defines the generators a pattern in midifoot.c can use instead of a list
+ * of values.
+ *
+ * Patterns are kept in flash: the first three bytes of the packet, which
+ * are the same for every step, then the number of steps (up to 255) and the
+ * last byte of each step. A step count of 0 is followed by one of the
+ * generators below, which compute the last byte from the step number.
+ */
+
+#ifndef __patterns_h_included__
+#define __patterns_h_included__
+
+#define KIND_BITREV 1
+#define KIND_EUCLID 2
+#define KIND_LFSR 3
+
+#define GEN_BITREV(bits, lo, hi) 0, KIND_BITREV, bits, lo, hi
+/* 2^bits steps (bits <= 15), step n sends lo-hi scaled by n with its bits
+ * reversed, so that every 2nd, 4th, 8th... step stays within a range 1/2,
+ * 1/4, 1/8... as wide. Even steps send the upper half, odd steps the lower,
+ * like presses and releases in midiPattern.
+ */
+#define GEN_EUCLID(steps, pulses, on, off) 0, KIND_EUCLID, steps, pulses, on, off
+/* Euclidean rhythm, spreads pulses as evenly as possible over the steps (up
+ * to 255), sends on for a pulse and off for the others.
+ */
+#define GEN_LFSR(lo, hi) 0, KIND_LFSR, lo, hi
+/* Pseudo random values in lo-hi from a 16 bit Galois LFSR, repeats after
+ * 65535 steps. The step is the LFSR state, starting from 0xace1.
+ */
+
+#endif /* __patterns_h_included__ */
@@ -0,0 +1,105 @@
+/* Name: requests.h
+ * Project: Single button midi controller
+ * Author: Bill Peterson
+ */
+
+/* This header is shared between the firmware and the host tools. It defines
+ * the vendor requests understood by usbFunctionSetup() in midifoot.c. All of
+ * them are control transfers of type "vendor" with recipient "device", so
+ * they work while the MIDI interfaces are claimed by the host's audio driver.
+ */
+
+#ifndef __requests_h_included__
+#define __requests_h_included__
+
+#define MIDIFOOT_RQ_GET_LATENCY     1
+/* Device to host. Returns the latency statistics of an instrumented build
+ * (MIDIFOOT_LATENCY_STATS), an array of MIDIFOOT_LATENCY_COUNT records of
+ * 20 bytes each:
+ *   uint16 min, uint16 max (little endian), uint8 hist[16]
+ * Times are in timer0 counts of 64 CPU cycles (4 us at 16 MHz). hist[n]
+ * counts the values with n significant bits (hist[0] counts zeroes, hist[15]
+ * everything from 16384 up). When a bucket overflows all buckets are halved.
+ * The records are, in this order:
+ */
+#define MIDIFOOT_LATENCY_DEBOUNCE   0   /* first edge on PB0 to debounced change */
+#define MIDIFOOT_LATENCY_QUEUE      1   /* queue push to usbSetInterrupt() */
+#define MIDIFOOT_LATENCY_HOST       2   /* usbSetInterrupt() to sent on an IN token */
+#define MIDIFOOT_LATENCY_TOTAL      3   /* origin (edge or gesture timeout) to sent */
+#define MIDIFOOT_LATENCY_COUNT      4
+
+#define MIDIFOOT_RQ_RESET_LATENCY   2
+/* Clears the latency statistics. */
+
+#define MIDIFOOT_RQ_GET_LOOP        3
+/* Device to host. Returns the main loop statistics of an instrumented build
+ * (MIDIFOOT_LOOP_STATS), MIDIFOOT_LOOP_COUNT records in the same format as
+ * MIDIFOOT_RQ_GET_LATENCY. The max field is the worst case watermark.
+ */
+#define MIDIFOOT_LOOP_INTERVAL      0   /* start of one usbPoll() to the next, idle included */
+#define MIDIFOOT_LOOP_POLL          1   /* time spent in usbPoll() */
+#define MIDIFOOT_LOOP_BUSY          2   /* loop pass up to going to sleep */
+#define MIDIFOOT_LOOP_COUNT         3
+
+#define MIDIFOOT_RQ_RESET_LOOP      4
+/* Clears the main loop statistics. */
+
+#define MIDIFOOT_RQ_GET_MEMORY      5
+/* Device to host. Returns the RAM usage of a build with MIDIFOOT_MEMORY_STATS
+ * as three uint16 (little endian): bytes of static data (.data and .bss),
+ * deepest stack seen since reset, and bytes between the two that were never
+ * touched. The last one is the real safety margin.
+ */
+
+#define MIDIFOOT_RQ_GET_TRACE       6
+/* Device to host. Returns and removes the oldest trace records of a build
+ * with MIDIFOOT_TRACE, as many whole records as fit into wLength. A short
+ * or empty reply means the buffer is drained. While a reply is being sent,
+ * new records that don't fit are lost instead of overwriting old ones.
+ * Trace records are stored back to back, each one is
+ *   uint8 id, uint8 len, uint16 time (little endian), uint8 data[len]
+ * The time is in timer0 counts like the statistics above and wraps every
+ * 262 ms. Ids below 0x30 come from the driver's DBG1() and DBG2() calls:
+ *   0x1d, 0x11:    SETUP and OUT data received, including the CRC (level 2)
+ *   0x20:          control IN data to send (level 2)
+ *   0x21-0x23:     interrupt IN data armed (level 2)
+ *   0xff:          usbInit()
+ * The firmware adds:
+ */
+#define MIDIFOOT_TRACE_RESET        0x30    /* startup, data: MCUSR */
+#define MIDIFOOT_TRACE_BUTTON       0x31    /* debounced change, data: PB0 (0 = pressed) */
+#define MIDIFOOT_TRACE_EVENT        0x32    /* queued, data: the USB-MIDI packet */
+#define MIDIFOOT_TRACE_DROP         0x33    /* queue full, data: the lost packet */
+#define MIDIFOOT_TRACE_GESTURE      0x34    /* gesture recognized, data: gesture number */
+#define MIDIFOOT_TRACE_SUSPEND      0x35    /* bus idle, powering down */
+#define MIDIFOOT_TRACE_WAKEUP       0x36    /* button pressed, signalled remote wakeup */
+#define MIDIFOOT_TRACE_RESUME       0x37    /* woken up from power down */
+
+#define MIDIFOOT_RQ_GET_HEALTH      7
+/* Device to host. Returns the fault counters of a build with MIDIFOOT_HEALTH,
+ * MIDIFOOT_HEALTH_COUNT uint16 counters followed by a uint32 of timer ticks
+ * (1.024 ms) during which interrupt data waited for an IN token. All little
+ * endian, counters stop at 65535. Bus resets include the ones of normal
+ * enumeration; many more than power ons point to the cable or the host.
+ */
+#define MIDIFOOT_HEALTH_POWER_ON    0   /* power on resets */
+#define MIDIFOOT_HEALTH_EXTERNAL    1   /* resets through the reset pin */
+#define MIDIFOOT_HEALTH_WATCHDOG    2   /* watchdog resets, the main loop hung */
+#define MIDIFOOT_HEALTH_BROWN_OUT   3   /* supply dropped below the BOD level */
+#define MIDIFOOT_HEALTH_BUS_RESET   4   /* USB bus resets */
+#define MIDIFOOT_HEALTH_DROPPED     5   /* events lost, the USB event queue was full */
+#define MIDIFOOT_HEALTH_DIN_LATE    6   /* DIN output bits sent half a bit late or more */
+#define MIDIFOOT_HEALTH_DIN_DROPPED 7   /* messages lost, the DIN queue was full */
+#define MIDIFOOT_HEALTH_COUNT       8
+
+#define MIDIFOOT_RQ_RESET_HEALTH    8
+/* Clears the fault counters, in RAM and in EEPROM. */
+
+#define MIDIFOOT_RQ_SET_SERIAL      9
+/* Assigns the serial number of a build with MIDIFOOT_SERIAL, a 32 bit ID
+ * with the low half in wValue and the high half in wIndex. It is saved to
+ * EEPROM and the host sees it after the next enumeration. 0xffffffff makes
+ * the device pick a new random one on the next power up.
+ */
+
+#endif /* __requests_h_included__ */
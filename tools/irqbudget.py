@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+# Name: irqbudget.py
+# Project: MidiFoot
+# License: MIT
+"""Check how long the firmware keeps interrupts disabled.
+
+V-USB's interrupt must start within a few cycles of the sync pattern at the
+start of each packet, so no other code may hold off interrupts for longer
+than 25 cycles at 12 MHz (more at faster clocks, see "Interrupt latency" in
+usbdrv/usbdrv.h). This reads the output of "make disasm" (avr-objdump -d)
+and finds the worst case path through every region with interrupts off:
+
+  interrupt routines: from the interrupt response to reti, or to sei for
+                      routines that enable interrupts first (ISR_NOBLOCK)
+  cli regions:        from cli to sei, or to a write of SREG that restores
+                      the previous state (ATOMIC_RESTORESTATE, timeNow())
+
+Calls are followed. Indirect jumps, loops and returns with interrupts off
+can't be bounded and count as failures, unless the region lies in a function
+given with --allow. V-USB's own interrupt routine is skipped, it is the one
+being protected, and so is avr-libc's _exit, which stops the program with
+interrupts off. Exits with 1 if a region is over the limit.
+
+Usage: avr-objdump -d midifoot.bin | tools/irqbudget.py --clock 16000000
+"""
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r'^\s*([0-9a-f]+):\t([0-9a-f ]+?)\s*\t(\S+)\s*([^;]*)(?:;\s*0x([0-9a-f]+)(?: <([^>+]+))?)?')
+LABEL = re.compile(r'^([0-9a-f]+) <(\S+)>:$')
+
+RESPONSE = 4                    # cycles from interrupt to the vector
+BRANCHES = ('brbc', 'brbs', 'breq', 'brne', 'brcs', 'brcc', 'brsh', 'brlo',
+            'brmi', 'brpl', 'brge', 'brlt', 'brhs', 'brhc', 'brts', 'brtc',
+            'brvs', 'brvc', 'brie', 'brid')
+SKIPS = ('sbrc', 'sbrs', 'sbic', 'sbis', 'cpse')
+# cycles on the AVRe core of the ATtiny85, anything else takes one
+CYCLES = {
+    'adiw': 2, 'sbiw': 2, 'ld': 2, 'ldd': 2, 'st': 2, 'std': 2, 'lds': 2,
+    'sts': 2, 'push': 2, 'pop': 2, 'rjmp': 2, 'ijmp': 2, 'sbi': 2, 'cbi': 2,
+    'jmp': 3, 'rcall': 3, 'icall': 3, 'lpm': 3, 'call': 4, 'ret': 4, 'reti': 4,
+}
+
+
+class Unbounded(Exception):
+    pass
+
+
+class Program:
+    def __init__(self, lines):
+        self.code = {}          # address: (size, mnemonic, operands, target)
+        self.names = {}         # address: symbol named in the comment
+        self.labels = []        # (address, name), in order
+        for line in lines:
+            m = LABEL.match(line.strip())
+            if m:
+                self.labels.append((int(m.group(1), 16), m.group(2)))
+                continue
+            m = LINE.match(line)
+            if not m or m.group(3).startswith('.'):
+                continue
+            target = int(m.group(5), 16) if m.group(5) else None
+            if m.group(6):
+                self.names[int(m.group(1), 16)] = m.group(6)
+            self.code[int(m.group(1), 16)] = (len(m.group(2).split()), m.group(3),
+                                               m.group(4).strip(), target)
+        self.labels.sort()
+        self.funcMemo = {}
+
+    def function(self, addr):
+        name = '?'
+        for a, n in self.labels:
+            if a > addr:
+                break
+            name = n
+        return name
+
+    def at(self, addr):
+        if addr not in self.code:
+            raise Unbounded('no code at %04x' % addr)
+        return self.code[addr]
+
+    def next(self, addr):
+        return addr + self.at(addr)[0]
+
+    def worst(self, addr, isr, memo, path):
+        """Worst case cycles from addr to the end of the region."""
+        if addr in memo:
+            return memo[addr]
+        if addr in path:
+            raise Unbounded('loop at %04x in %s' % (addr, self.function(addr)))
+        path.add(addr)
+        size, op, args, target = self.at(addr)
+        c = CYCLES.get(op, 1)
+        if op == 'sei':         # the next instruction runs before any interrupt
+            n = self.at(self.next(addr))
+            cycles = c + CYCLES.get(n[1], 1)
+        elif op == 'reti':
+            cycles = c
+        elif op == 'out' and args.startswith('0x3f') and not isr:
+            cycles = c          # SREG restored
+        elif op == 'ret':
+            raise Unbounded('returns from %s with interrupts off' % self.function(addr))
+        elif op in ('ijmp', 'icall', 'eijmp', 'eicall'):
+            raise Unbounded('indirect jump at %04x in %s' % (addr, self.function(addr)))
+        elif op in ('rcall', 'call'):
+            cycles = c + self.callee(target) + self.worst(self.next(addr), isr, memo, path)
+        elif op in ('rjmp', 'jmp'):
+            cycles = c + self.worst(target, isr, memo, path)
+        elif op in BRANCHES:
+            cycles = max(1 + self.worst(self.next(addr), isr, memo, path),
+                         2 + self.worst(target, isr, memo, path))
+        elif op in SKIPS:
+            skipped = self.next(addr)
+            cycles = max(1 + self.worst(skipped, isr, memo, path),
+                         1 + self.at(skipped)[0] // 2
+                         + self.worst(self.next(skipped), isr, memo, path))
+        else:
+            cycles = c + self.worst(self.next(addr), isr, memo, path)
+        path.discard(addr)
+        memo[addr] = cycles
+        return cycles
+
+    def callee(self, addr, path=None):
+        """Worst case cycles of a function called at addr, through its ret."""
+        if addr in self.funcMemo:
+            return self.funcMemo[addr]
+        path = set() if path is None else path
+        memo = {}
+
+        def walk(a):
+            if a in memo:
+                return memo[a]
+            if a in path:
+                raise Unbounded('loop at %04x in %s' % (a, self.function(a)))
+            path.add(a)
+            size, op, args, target = self.at(a)
+            c = CYCLES.get(op, 1)
+            if op in ('ret', 'reti'):
+                cycles = c
+            elif op in ('ijmp', 'icall', 'eijmp', 'eicall'):
+                raise Unbounded('indirect jump at %04x in %s' % (a, self.function(a)))
+            elif op in ('rcall', 'call'):
+                cycles = c + self.callee(target, path) + walk(self.next(a))
+            elif op in ('rjmp', 'jmp'):
+                cycles = c + walk(target)
+            elif op in BRANCHES:
+                cycles = max(1 + walk(self.next(a)), 2 + walk(target))
+            elif op in SKIPS:
+                skipped = self.next(a)
+                cycles = max(1 + walk(skipped),
+                             1 + self.at(skipped)[0] // 2 + walk(self.next(skipped)))
+            else:
+                cycles = c + walk(self.next(a))
+            path.discard(a)
+            memo[a] = cycles
+            return cycles
+
+        cycles = walk(addr)
+        self.funcMemo[addr] = cycles
+        return cycles
+
+    def regions(self, skip):
+        """(start, description, function, isr) of every region."""
+        vectors = [a for a, n in self.labels if n == '__vectors']
+        if vectors:
+            addr = vectors[0]
+            end = min([a for a, n in self.labels if a > addr] or [addr])
+            n = 0
+            while addr < end and addr in self.code:
+                size, op, args, target = self.code[addr]
+                name = self.names.get(addr, '?')
+                if n and op in ('rjmp', 'jmp') and name not in skip \
+                        and name != '__bad_interrupt':
+                    yield addr, 'vector %d (%s)' % (n, name), name, True
+                addr += size
+                n += 1
+        for addr in sorted(self.code):
+            name = self.function(addr)
+            if self.code[addr][1] == 'cli' and name != '_exit':
+                yield addr, 'cli at %04x (%s)' % (addr, name), name, False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('disasm', nargs='?', type=argparse.FileType('r'),
+                        default=sys.stdin, help='avr-objdump -d output')
+    parser.add_argument('--clock', type=float, default=16e6,
+                        help='F_CPU in Hz (default 16000000)')
+    parser.add_argument('--limit', type=int,
+                        help='cycles allowed (default 25 at 12 MHz, scaled)')
+    parser.add_argument('--allow', action='append', default=[],
+                        metavar='FUNCTION',
+                        help='accept any region in this function')
+    parser.add_argument('--usb-vector', default='__vector_1',
+                        help="V-USB's interrupt routine (default INT0)")
+    args = parser.parse_args()
+    limit = args.limit or int(25 * args.clock / 12e6)
+
+    program = Program(args.disasm)
+    if not program.code:
+        sys.exit('irqbudget: no disassembly on input')
+    failed = 0
+    for addr, what, name, isr in program.regions({args.usb_vector}):
+        try:
+            cycles = program.worst(addr, isr, {}, set()) + (RESPONSE if isr else 0)
+            result = '%5d cycles' % cycles
+            over = cycles > limit
+        except Unbounded as e:
+            result = 'unbounded, %s' % e
+            over = True
+        if over and name in args.allow:
+            result += ' (allowed)'
+            over = False
+        elif over:
+            result += ' OVER'
+            failed = 1
+        print('%-40s %s' % (what, result))
+    print('limit %d cycles at %.1f MHz' % (limit, args.clock / 1e6))
+    sys.exit(failed)
+
+
+if __name__ == '__main__':
+    main()
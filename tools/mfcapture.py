@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+# Name: mfcapture.py
+# Project: MidiFoot
+# License: MIT
+"""Measure a MidiFoot's USB traffic in a Linux usbmon capture.
+
+Reads the usbmon text interface (cat /sys/kernel/debug/usb/usbmon/1u) or a
+pcap/pcapng file saved by Wireshark or tcpdump from a usbmonN interface,
+finds the MidiFoot (16c0:05e4) by its device descriptor in the capture,
+or by --device when the capture started after enumeration, and reports
+on its interrupt IN endpoint:
+
+  events:       the MIDI events and the time between them
+  poll jitter:  how far the gaps between transfers stray from a multiple
+                of the poll interval
+  NAKs:         the host controller retries NAKed polls on its own, so
+                usbmon doesn't see them. They are estimated from how long
+                each transfer waited, one per poll interval.
+  sequence:     the events checked against the pattern (midiPattern in
+                midifoot.c, change --values when it changes), steps missing
+                from the rotation count as gaps
+
+Works offline, sample captures are in tools/captures.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+VID, PID = 0x16c0, 0x05e4
+EP_IN = 1
+# data bytes of midiPattern in midifoot.c, presses on even steps
+PATTERN = (70, 0, 100, 30, 85, 15, 115, 45, 75, 5, 105, 35, 80, 10, 110, 40)
+
+XFER_TYPES = {0: 'Z', 1: 'I', 2: 'C', 3: 'B'}  # pcap xfer_type to usbmon's
+LINKTYPE_USB_LINUX = 189
+LINKTYPE_USB_LINUX_MMAPPED = 220
+
+
+class Urb:
+    """One submission, completion or error, as usbmon reports it."""
+
+    def __init__(self, tag, time, event, xfer, is_in, bus, dev, ep,
+                 status, interval, data):
+        self.tag, self.time, self.event = tag, time, event
+        self.xfer, self.is_in = xfer, is_in
+        self.bus, self.dev, self.ep = bus, dev, ep
+        self.status, self.interval, self.data = status, interval, data
+
+
+def read_text(f):
+    """usbmon text lines, see Documentation/usb/usbmon.rst."""
+    for line in f:
+        tok = line.split()
+        if len(tok) < 5 or tok[3].count(':') != 3:
+            continue
+        kind, bus, dev, ep = tok[3].split(':')
+        i, status, interval = 4, 0, None
+        if tok[i] == 's':       # setup packet
+            i += 6
+        else:
+            words = tok[i].split(':')
+            status = int(words[0]) if words[0].lstrip('-').isdigit() else 0
+            if len(words) > 1:
+                interval = int(words[1])
+            i += 1
+        data = b''
+        if i + 2 < len(tok) and tok[i + 1] == '=':
+            data = bytes.fromhex(''.join(tok[i + 2:]))
+        yield Urb(tok[0], int(tok[1]) / 1e6, tok[2], kind[0], kind[1] == 'i',
+                  int(bus), int(dev), int(ep), status, interval, data)
+
+
+def read_usb_header(pkt, time, mmapped):
+    (tag, event, xfer, epnum, dev, bus, setup, nodata, sec, usec, status,
+     length, caplen) = struct.unpack_from('<QBBBBHbbqiiII', pkt)
+    interval = struct.unpack_from('<i', pkt, 48)[0] if mmapped else None
+    data = pkt[64 if mmapped else 48:][:caplen]
+    return Urb(tag, time, chr(event), XFER_TYPES.get(xfer, '?'), epnum >> 7,
+               bus, dev, epnum & 0x7f, status, interval, data)
+
+
+def read_pcap(f):
+    """Classic pcap, or pcapng with any number of interfaces."""
+    head = f.read(24)
+    magic = head[:4]
+    if magic == b'\x0a\x0d\x0d\x0a':
+        yield from read_pcapng(head + f.read())
+        return
+    if magic in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1'):
+        order = '<'
+    elif magic in (b'\xa1\xb2\xc3\xd4', b'\xa1\xb2\x3c\x4d'):
+        order = '>'
+    else:
+        sys.exit('mfcapture: not a pcap file')
+    unit = 1e-9 if magic in (b'\x4d\x3c\xb2\xa1', b'\xa1\xb2\x3c\x4d') else 1e-6
+    link, = struct.unpack_from(order + 'I', head, 20)
+    if link not in (LINKTYPE_USB_LINUX, LINKTYPE_USB_LINUX_MMAPPED):
+        sys.exit('mfcapture: not a usbmon capture (link type %d)' % link)
+    while True:
+        rec = f.read(16)
+        if len(rec) < 16:
+            break
+        sec, frac, caplen, _ = struct.unpack(order + 'IIII', rec)
+        pkt = f.read(caplen)
+        if len(pkt) >= 48:
+            yield read_usb_header(pkt, sec + frac * unit,
+                                  link == LINKTYPE_USB_LINUX_MMAPPED)
+
+
+def read_pcapng(buf):
+    order, pos, links = '<', 0, []
+    while pos + 12 <= len(buf):
+        kind, = struct.unpack_from(order + 'I', buf, pos)
+        if kind == 0x0a0d0d0a:  # section header, sets the byte order
+            order = '<' if buf[pos + 8:pos + 12] == b'\x4d\x3c\x2b\x1a' else '>'
+            links = []
+        length, = struct.unpack_from(order + 'I', buf, pos + 4)
+        if length < 12:
+            break
+        body = buf[pos + 8:pos + length - 4]
+        if kind == 1:           # interface description
+            link, = struct.unpack_from(order + 'H', body)
+            unit, opt = 1e-6, 8
+            while opt + 4 <= len(body):
+                code, size = struct.unpack_from(order + 'HH', body, opt)
+                if code == 0:
+                    break
+                if code == 9:   # if_tsresol
+                    r = body[opt + 4]
+                    unit = 2.0 ** -(r & 0x7f) if r & 0x80 else 10.0 ** -r
+                opt += 4 + (size + 3) // 4 * 4
+            links.append((link, unit))
+        elif kind == 6 and links:   # enhanced packet
+            iface, hi, lo, caplen = struct.unpack_from(order + 'IIII', body)
+            link, unit = links[iface]
+            pkt = body[20:20 + caplen]
+            if link in (LINKTYPE_USB_LINUX, LINKTYPE_USB_LINUX_MMAPPED) \
+                    and len(pkt) >= 48:
+                yield read_usb_header(pkt, (hi << 32 | lo) * unit,
+                                      link == LINKTYPE_USB_LINUX_MMAPPED)
+        pos += length
+
+
+def read_capture(path):
+    with open(path, 'rb') as f:
+        start = f.read(4)
+    if start in (b'\x0a\x0d\x0d\x0a', b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1',
+                 b'\xa1\xb2\xc3\xd4', b'\xa1\xb2\x3c\x4d'):
+        with open(path, 'rb') as f:
+            return list(read_pcap(f))
+    with open(path) as f:
+        return list(read_text(f))
+
+
+def find_device(urbs, wanted):
+    """(bus, dev) of the MidiFoot, from a GET_DESCRIPTOR reply."""
+    if wanted:
+        bus, dev = wanted.split(':')
+        return int(bus), int(dev)
+    found = None
+    for u in urbs:
+        d = u.data
+        if u.event == 'C' and u.xfer == 'C' and u.is_in and len(d) >= 12 \
+                and d[0] == 18 and d[1] == 1:
+            if struct.unpack_from('<HH', d, 8) == (VID, PID):
+                found = (u.bus, u.dev)  # the last one, after re-enumeration
+    return found
+
+
+def stats(values):
+    """min, median, 99th percentile, max and mean of a list."""
+    if not values:
+        return None
+    v = sorted(round(x, 3) for x in values)
+    pick = lambda q: v[min(len(v) - 1, int(q * len(v)))]
+    return {'count': len(v), 'min': v[0], 'median': pick(0.5),
+            'p99': pick(0.99), 'max': v[-1], 'mean': round(sum(v) / len(v), 3)}
+
+
+def analyze(urbs, bus, dev, values, interval_ms):
+    submitted = {}
+    transfers = []              # (time, wait, data)
+    interval = None
+    for u in urbs:
+        if (u.bus, u.dev, u.ep, u.xfer, u.is_in) != (bus, dev, EP_IN, 'I', 1):
+            continue
+        if u.interval:
+            interval = u.interval
+        if u.event == 'S':
+            submitted[u.tag] = u.time
+        elif u.event == 'C' and u.status == 0 and u.tag in submitted:
+            transfers.append((u.time, u.time - submitted.pop(u.tag), u.data))
+    # usbmon reports the interval in frames, 1 ms each at low speed
+    period = (interval_ms or interval or 10) / 1000.0
+
+    events = []                 # (time, USB-MIDI packet)
+    for t, wait, data in transfers:
+        for i in range(0, len(data) - 3, 4):
+            if any(data[i:i + 4]):
+                events.append((t, data[i:i + 4]))
+
+    gaps, skipped, unknown, pos = 0, 0, 0, None
+    for t, pkt in events:
+        v = pkt[3]
+        if v not in values:
+            unknown += 1
+            continue
+        if pos is None:
+            pos = values.index(v)
+            continue
+        n = 1
+        while values[(pos + n) % len(values)] != v:
+            n += 1              # a value repeats at most once per rotation
+        if n > 1:
+            gaps += 1
+            skipped += n - 1
+        pos = (pos + n) % len(values)
+
+    jitter = []
+    for a, b in zip(transfers, transfers[1:]):
+        d = b[0] - a[0]
+        jitter.append(abs(d - round(d / period) * period) * 1000)
+    return {
+        'device': '%d:%03d' % (bus, dev),
+        'interval_ms': period * 1000,
+        'transfers': len(transfers),
+        'events': len(events),
+        'duration_s': round(transfers[-1][0] - transfers[0][0], 6) if transfers else 0,
+        'between_ms': stats([(b[0] - a[0]) * 1000 for a, b in zip(events, events[1:])
+                             if b[0] != a[0]]),
+        'poll_jitter_ms': stats(jitter),
+        'wait_ms': stats([w * 1000 for t, w, d in transfers]),
+        'naks_estimated': sum(int(w / period) for t, w, d in transfers),
+        'sequence': {'gaps': gaps, 'skipped': skipped, 'unknown': unknown},
+    }
+
+
+def print_stats(name, s, unit):
+    if s:
+        print('%-12s min %8.3f, median %8.3f, p99 %8.3f, max %8.3f %s'
+              % (name, s['min'], s['median'], s['p99'], s['max'], unit))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', help='usbmon text, pcap or pcapng file')
+    parser.add_argument('--device', metavar='BUS:DEV',
+                        help='the MidiFoot, when the capture has no enumeration')
+    parser.add_argument('--interval', type=float, metavar='MS',
+                        help='poll interval (default from the capture, or 10)')
+    parser.add_argument('--values', default=','.join(map(str, PATTERN)),
+                        help='data byte of each pattern step, in order')
+    parser.add_argument('--json', action='store_true', help='machine readable')
+    args = parser.parse_args()
+
+    urbs = read_capture(args.capture)
+    found = find_device(urbs, args.device)
+    if not found:
+        sys.exit('mfcapture: no MidiFoot in the capture, use --device')
+    values = [int(v, 0) for v in args.values.split(',')]
+    r = analyze(urbs, found[0], found[1], values, args.interval)
+    if args.json:
+        print(json.dumps(r, indent=1))
+        return
+    print('device      %s (%04x:%04x), endpoint 0x81, %.0f ms interval'
+          % (r['device'], VID, PID, r['interval_ms']))
+    print('events      %d in %d transfers over %.1f s'
+          % (r['events'], r['transfers'], r['duration_s']))
+    print_stats('between', r['between_ms'], 'ms')
+    print_stats('poll jitter', r['poll_jitter_ms'], 'ms')
+    print_stats('waited', r['wait_ms'], 'ms')
+    print('NAKs        %d (estimated)' % r['naks_estimated'])
+    q = r['sequence']
+    print('sequence    %d gaps, %d steps skipped, %d unknown values'
+          % (q['gaps'], q['skipped'], q['unknown']))
+
+
+if __name__ == '__main__':
+    main()
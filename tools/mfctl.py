@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+# Name: mfctl.py
+# Project: MidiFoot
+# License: MIT
+"""Read diagnostics from a MidiFoot through its USB vendor requests.
+
+The requests are described in requests.h. Most of them only answer on
+firmware built with the matching option in midifootconfig.h. Needs pyusb
+(pip install pyusb) and access to the device (run as root or add a udev
+rule for 16c0:05e4).
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+VID, PID = 0x16c0, 0x05e4
+
+# vendor requests, keep in sync with requests.h
+RQ_GET_LATENCY = 1
+RQ_RESET_LATENCY = 2
+RQ_GET_LOOP = 3
+RQ_RESET_LOOP = 4
+RQ_GET_MEMORY = 5
+RQ_GET_TRACE = 6
+RQ_GET_HEALTH = 7
+RQ_RESET_HEALTH = 8
+RQ_SET_SERIAL = 9
+
+LATENCY_NAMES = ('debounce', 'queue', 'host', 'total')
+LOOP_NAMES = ('interval', 'usbPoll', 'busy')
+HEALTH_NAMES = ('power on resets', 'reset pin resets', 'watchdog resets',
+                'brown-outs', 'USB bus resets', 'dropped events',
+                'late DIN bits', 'dropped DIN')
+TRACE_NAMES = {
+    0x11: 'rx data', 0x1d: 'rx setup', 0x20: 'tx ctrl',
+    0x21: 'tx intr', 0x22: 'tx intr', 0x23: 'tx intr', 0xff: 'usbInit',
+    0x30: 'reset', 0x31: 'button', 0x32: 'event', 0x33: 'drop',
+    0x34: 'gesture', 0x35: 'suspend', 0x36: 'wakeup', 0x37: 'resume',
+}
+TRACE_CHUNK = 64
+
+RQ_IN = 0xc0    # vendor, device, device to host
+RQ_OUT = 0x40   # vendor, device, host to device
+
+
+def serial_number(dev):
+    """The serial number string, None without MIDIFOOT_SERIAL."""
+    return dev.serial_number if dev.iSerialNumber else None
+
+
+def open_device(args):
+    import usb.core
+    for dev in usb.core.find(find_all=True, idVendor=VID, idProduct=PID):
+        if not args.serial or serial_number(dev) == args.serial.upper():
+            return dev
+    sys.exit('mfctl: no MidiFoot found'
+             + (' with serial number ' + args.serial if args.serial else ''))
+
+
+def request_in(dev, request, length, value=0, index=0):
+    return bytes(dev.ctrl_transfer(RQ_IN, request, value, index, length))
+
+
+def request_out(dev, request, value=0, index=0):
+    dev.ctrl_transfer(RQ_OUT, request, value, index, None)
+
+
+def print_stats(names, data, unit_us):
+    """Print records of uint16 min, uint16 max, uint8 hist[16]."""
+    for i, name in enumerate(names):
+        rec = data[i * 20:(i + 1) * 20]
+        if len(rec) < 20:
+            break
+        lo, hi = struct.unpack_from('<HH', rec)
+        hist = rec[4:]
+        count = sum(hist)
+        if not count:
+            print('%-10s no samples' % name)
+            continue
+        print('%-10s min %9.1f us  max %9.1f us' % (name, lo * unit_us, hi * unit_us))
+        for n, c in enumerate(hist):
+            if not c:
+                continue
+            lower = (1 << (n - 1)) if n else 0
+            label = ('>= %.0f us' % (lower * unit_us) if n == 15
+                     else '< %.0f us' % ((1 << n) * unit_us))
+            print('    %-12s %3d %s' % (label, c, '#' * (c * 40 // max(hist))))
+
+
+def read_stats(args, names, get, reset, option):
+    dev = open_device(args)
+    data = request_in(dev, get, 20 * len(names))
+    if not data:
+        sys.exit('mfctl: firmware was built without ' + option)
+    print_stats(names, data, 64e6 / args.fcpu)
+    if args.reset:
+        request_out(dev, reset)
+
+
+def cmd_latency(args):
+    read_stats(args, LATENCY_NAMES, RQ_GET_LATENCY, RQ_RESET_LATENCY,
+               'MIDIFOOT_LATENCY_STATS')
+
+
+def cmd_loop(args):
+    read_stats(args, LOOP_NAMES, RQ_GET_LOOP, RQ_RESET_LOOP,
+               'MIDIFOOT_LOOP_STATS')
+
+
+def cmd_memory(args):
+    dev = open_device(args)
+    data = request_in(dev, RQ_GET_MEMORY, 6)
+    if len(data) < 6:
+        sys.exit('mfctl: firmware was built without MIDIFOOT_MEMORY_STATS')
+    static, stack, free = struct.unpack('<HHH', data)
+    print('static data  %3d bytes' % static)
+    print('stack peak   %3d bytes' % stack)
+    print('never used   %3d bytes' % free)
+
+
+def cmd_health(args):
+    dev = open_device(args)
+    size = 2 * len(HEALTH_NAMES) + 4
+    data = request_in(dev, RQ_GET_HEALTH, size)
+    if len(data) < size:
+        sys.exit('mfctl: firmware was built without MIDIFOOT_HEALTH')
+    counts = struct.unpack_from('<%dH' % len(HEALTH_NAMES), data)
+    for name, count in zip(HEALTH_NAMES, counts):
+        print('%-17s %5d%s' % (name, count, '+' if count == 0xffff else ''))
+    wait, = struct.unpack_from('<I', data, 2 * len(HEALTH_NAMES))
+    print('%-17s %9.3f s' % ('waiting for host', wait * 16384 / args.fcpu))
+    if args.reset:
+        request_out(dev, RQ_RESET_HEALTH)
+
+
+def cmd_trace(args):
+    dev = open_device(args)
+    unit_us = 64e6 / args.fcpu
+    last = None
+    while True:
+        data = request_in(dev, RQ_GET_TRACE, TRACE_CHUNK)
+        i = 0
+        while i + 4 <= len(data):
+            rid, n, t = struct.unpack_from('<BBH', data, i)
+            payload = data[i + 4:i + 4 + n]
+            i += 4 + n
+            # times wrap every 65536 counts, only the gaps are meaningful
+            delta = 0 if last is None else (t - last) & 0xffff
+            last = t
+            print('%+10.3f ms  %-8s %s' % (delta * unit_us / 1000,
+                  TRACE_NAMES.get(rid, '0x%02x' % rid), payload.hex(' ')))
+        if len(data) < TRACE_CHUNK:
+            if not args.follow:
+                break
+            time.sleep(0.05)
+
+
+def cmd_serial(args):
+    if args.set is None:
+        import usb.core
+        for dev in usb.core.find(find_all=True, idVendor=VID, idProduct=PID):
+            print('bus %03d device %03d  serial %s'
+                  % (dev.bus, dev.address, serial_number(dev) or 'none'))
+        return
+    dev = open_device(args)
+    if not dev.iSerialNumber:
+        sys.exit('mfctl: firmware was built without MIDIFOOT_SERIAL')
+    if args.set == 'new':
+        value = 0xffffffff
+    else:
+        value = int(args.set, 16)
+        if not 0 <= value < 0xffffffff:
+            sys.exit('mfctl: the serial number is 8 hex digits, not FFFFFFFF')
+    request_out(dev, RQ_SET_SERIAL, value & 0xffff, value >> 16)
+    if args.set == 'new':
+        print('a new serial number is made up on the next power up')
+    else:
+        print('serial number %08X, seen by the host when it enumerates the'
+              ' device again' % value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--fcpu', type=float, default=16e6,
+                        help='CPU clock of the firmware (default 16e6)')
+    parser.add_argument('--serial', metavar='SERIAL',
+                        help='the MidiFoot with this serial number, when there are several')
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('latency', help='edge to USB latency statistics')
+    p.add_argument('--reset', action='store_true', help='clear after reading')
+    p.set_defaults(func=cmd_latency)
+    p = sub.add_parser('loop', help='main loop and usbPoll() timing')
+    p.add_argument('--reset', action='store_true', help='clear after reading')
+    p.set_defaults(func=cmd_loop)
+    p = sub.add_parser('memory', help='RAM usage and stack high-water mark')
+    p.set_defaults(func=cmd_memory)
+    p = sub.add_parser('health', help='fault counters, kept across resets')
+    p.add_argument('--reset', action='store_true', help='clear after reading')
+    p.set_defaults(func=cmd_health)
+    p = sub.add_parser('trace', help='drain the trace buffer')
+    p.add_argument('-f', '--follow', action='store_true',
+                   help='keep reading until interrupted')
+    p.set_defaults(func=cmd_trace)
+    p = sub.add_parser('serial', help='list serial numbers or assign one')
+    p.add_argument('--set', metavar='HEX',
+                   help="new serial number, 'new' for a random one on the next power up")
+    p.set_defaults(func=cmd_serial)
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,303 @@
+/* Name: mflatency.c
+ * Project: MidiFoot
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Measures how long MidiFoot events take to reach an application. Reads the
+ * ALSA rawmidi port with kernel timestamps (SND_RAWMIDI_READ_TSTAMP, Linux
+ * 5.14 and alsa-lib 1.2.6 or later), which the USB MIDI driver takes when the transfer from
+ * the device completes, and compares them with CLOCK_MONOTONIC when the
+ * read returns. Each event is checked against the pattern rotation, so
+ * lost events show up as gaps.
+ *
+ * The real press times are only known to a simulator. With -t the press
+ * times come from a file (usually a fifo) of CLOCK_MONOTONIC nanoseconds,
+ * one line per event, as written by "host/midifoot-sim -m port -T file",
+ * which plays the firmware's messages in real time into an ALSA virtual
+ * rawmidi port (snd-virmidi), see the README.
+ *
+ * Build with "make tools/mflatency" (needs the ALSA headers, libasound2-dev).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+#define EVENTS_MAX 100000
+
+#if SND_LIB_VERSION < 0x010206      // no timestamps, times are taken at the read
+#define snd_rawmidi_tread(in, ts, buf, size) snd_rawmidi_read(in, buf, size)
+#endif
+
+// data bytes of midiPattern in midifoot.c, change with -V
+uint8_t pattern[256] = {70, 0, 100, 30, 85, 15, 115, 45, 75, 5, 105, 35, 80, 10, 110, 40};
+int patternLen = 16;
+
+int json = 0;
+int verbose = 0;
+volatile sig_atomic_t stop = 0;
+
+// nanoseconds per event for each measured span
+typedef struct
+{
+    const char *name;
+    int64_t *ns;
+    long count;
+} span_t;
+
+enum { SPAN_DRIVER, SPAN_PRESS_KERNEL, SPAN_PRESS_APP, SPAN_BETWEEN, SPAN_COUNT };
+span_t spans[SPAN_COUNT] = {
+    {"driver_to_app"}, {"press_to_driver"}, {"press_to_app"}, {"between_events"},
+};
+
+void spanAdd(int span, int64_t ns)
+{
+    span_t *s = &spans[span];
+    if (!s->ns) s->ns = malloc(EVENTS_MAX * sizeof(int64_t));
+    if (s->count < EVENTS_MAX) s->ns[s->count++] = ns;
+}
+
+int compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int64_t percentile(span_t *s, double p)
+{
+    long i = (long)(p * s->count);
+    return s->ns[i < s->count ? i : s->count - 1];
+}
+
+void spanPrint(span_t *s, int first)
+{
+    if (!s->count) return;
+    qsort(s->ns, s->count, sizeof(int64_t), compare);
+    double sum = 0, sq = 0;
+    for (long i = 0; i < s->count; i++) sum += s->ns[i];
+    double mean = sum / s->count;
+    for (long i = 0; i < s->count; i++) sq += (s->ns[i] - mean) * (s->ns[i] - mean);
+    double jitter = s->count > 1 ? sqrt(sq / (s->count - 1)) : 0;
+    if (json)
+    {
+        printf("%s \"%s\": {\"count\": %ld, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f,"
+            " \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f, \"mean\": %.3f, \"stddev\": %.3f}",
+            first ? "" : ",", s->name, s->count, s->ns[0] / 1e6, percentile(s, 0.5) / 1e6,
+            percentile(s, 0.9) / 1e6, percentile(s, 0.99) / 1e6, percentile(s, 0.999) / 1e6,
+            s->ns[s->count - 1] / 1e6, mean / 1e6, jitter / 1e6);
+        return;
+    }
+    printf("%-16s %6ld  min %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f  sd %7.3f ms\n",
+        s->name, s->count, s->ns[0] / 1e6, percentile(s, 0.5) / 1e6, percentile(s, 0.9) / 1e6,
+        percentile(s, 0.99) / 1e6, s->ns[s->count - 1] / 1e6, jitter / 1e6);
+}
+
+int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// first rawmidi port of the card named like the device, "hw:N,0"
+int findPort(char *port, size_t size)
+{
+    int card = -1;
+    while (snd_card_next(&card) == 0 && card >= 0)
+    {
+        char *name;
+        if (snd_card_get_name(card, &name) < 0) continue;
+        int found = strstr(name, "MIDIFoot") != NULL;
+        free(name);
+        if (found)
+        {
+            snprintf(port, size, "hw:%d,0", card);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void onSignal(int sig)
+{
+    stop = 1;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "usage: mflatency [-p port] [-n events] [-t press_times] [-V v0,v1,...]"
+        " [-j] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    char port[64] = "";
+    const char *presses = NULL;
+    long wanted = 0;
+    int c;
+    while ((c = getopt(argc, argv, "p:n:t:V:jv")) != -1)
+    {
+        switch (c)
+        {
+        case 'p': snprintf(port, sizeof(port), "%s", optarg); break;
+        case 'n': wanted = atol(optarg); break;
+        case 't': presses = optarg; break;
+        case 'V':
+            patternLen = 0;
+            for (char *v = strtok(optarg, ","); v && patternLen < 256; v = strtok(NULL, ","))
+            {
+                pattern[patternLen++] = atoi(v);
+            }
+            if (!patternLen) usage();
+            break;
+        case 'j': json = 1; break;
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (!*port && findPort(port, sizeof(port)))
+    {
+        fprintf(stderr, "mflatency: no MidiFoot found, give the port with -p\n");
+        return 2;
+    }
+
+    snd_rawmidi_t *in;
+    int err = snd_rawmidi_open(&in, NULL, port, SND_RAWMIDI_NONBLOCK);
+    if (err < 0)
+    {
+        fprintf(stderr, "mflatency: %s: %s\n", port, snd_strerror(err));
+        return 2;
+    }
+    int stamped = 0;
+#if SND_LIB_VERSION >= 0x010206
+    snd_rawmidi_params_t *params;
+    snd_rawmidi_params_alloca(&params);
+    snd_rawmidi_params_current(in, params);
+    snd_rawmidi_params_set_read_mode(in, params, SND_RAWMIDI_READ_TSTAMP);
+    snd_rawmidi_params_set_clock_type(in, params, SND_RAWMIDI_CLOCK_MONOTONIC);
+    stamped = snd_rawmidi_params(in, params) == 0;
+#endif
+    if (!stamped)
+    {
+        fprintf(stderr, "mflatency: no kernel timestamps on %s, measuring from the read\n", port);
+    }
+    FILE *pressFile = NULL;
+    if (presses && !(pressFile = fopen(presses, "r")))
+    {
+        perror(presses);
+        return 2;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    int nfds = snd_rawmidi_poll_descriptors_count(in);
+    struct pollfd fds[nfds];
+    snd_rawmidi_poll_descriptors(in, fds, nfds);
+
+    uint8_t msg[3];
+    int msgLen = 0, msgNeed = 0;
+    long events = 0, gaps = 0, skipped = 0, unknown = 0, unmatched = 0;
+    int pos = -1;
+    int64_t last = 0;
+    while (!stop && (!wanted || events < wanted))
+    {
+        if (poll(fds, nfds, 200) <= 0) continue;
+        uint8_t buf[64];
+        struct timespec ts;
+        ssize_t n = stamped ? snd_rawmidi_tread(in, &ts, buf, sizeof(buf))
+                            : snd_rawmidi_read(in, buf, sizeof(buf));
+        int64_t app = monotonicNs();
+        if (n == -EAGAIN) continue;
+        if (n < 0)
+        {
+            fprintf(stderr, "mflatency: %s\n", snd_strerror(n));
+            break;
+        }
+        int64_t kernel = stamped ? ts.tv_sec * 1000000000LL + ts.tv_nsec : app;
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t b = buf[i];
+            if (b >= 0xf8) continue;            // real time messages
+            if (b & 0x80)                       // status byte
+            {
+                msg[0] = b;
+                msgLen = 1;
+                msgNeed = (b & 0xe0) == 0xc0 ? 2 : b < 0xf0 ? 3 : 0;
+                continue;
+            }
+            if (!msgNeed || msgLen >= msgNeed) continue;
+            msg[msgLen++] = b;
+            if (msgLen < msgNeed) continue;
+            msgLen = 1;                         // running status
+
+            uint8_t value = msg[msgNeed - 1];
+            events++;
+            if (verbose) printf("%02x %02x %02x\n", msg[0], msg[1], msgNeed > 2 ? msg[2] : 0);
+            spanAdd(SPAN_DRIVER, app - kernel);
+            if (last) spanAdd(SPAN_BETWEEN, kernel - last);
+            last = kernel;
+            if (pressFile)
+            {
+                unsigned long long press;
+                if (fscanf(pressFile, "%llu", &press) == 1)
+                {
+                    spanAdd(SPAN_PRESS_KERNEL, kernel - (int64_t)press);
+                    spanAdd(SPAN_PRESS_APP, app - (int64_t)press);
+                }
+                else unmatched++;
+            }
+            // follow the rotation, a step missing from it is a gap
+            int k;
+            for (k = 1; k <= patternLen; k++)
+            {
+                if (pattern[(pos + k) % patternLen] == value) break;
+            }
+            if (k > patternLen) unknown++;
+            else if (pos < 0) pos = (pos + k) % patternLen;
+            else
+            {
+                if (k > 1)
+                {
+                    gaps++;
+                    skipped += k - 1;
+                }
+                pos = (pos + k) % patternLen;
+            }
+        }
+    }
+    snd_rawmidi_close(in);
+
+    if (json)
+    {
+        printf("{\"port\": \"%s\", \"events\": %ld, \"kernel_timestamps\": %s,"
+            " \"gaps\": %ld, \"skipped\": %ld, \"unknown\": %ld, \"unmatched\": %ld,"
+            " \"ms\": {", port, events, stamped ? "true" : "false", gaps, skipped,
+            unknown, unmatched);
+        int first = 1;
+        for (int i = 0; i < SPAN_COUNT; i++)
+        {
+            if (!spans[i].count) continue;
+            spanPrint(&spans[i], first);
+            first = 0;
+        }
+        printf("}}\n");
+        return 0;
+    }
+    printf("port             %s, %ld events\n", port, events);
+    for (int i = 0; i < SPAN_COUNT; i++) spanPrint(&spans[i], 0);
+    printf("sequence         %ld gaps, %ld steps skipped, %ld unknown values\n",
+        gaps, skipped, unknown);
+    if (unmatched) printf("press times      %ld events without one\n", unmatched);
+    return 0;
+}
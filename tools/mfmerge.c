@@ -0,0 +1,259 @@
+/* Name: mfmerge.c
+ * Project: MidiFoot
+ * Author: Bill Peterson
+ * Tabsize: 4
+ * License: MIT
+ */
+
+/* Merges every MidiFoot on the system into one ALSA sequencer port. Cards
+ * are found by their USB id in /proc/asound/cardN/usbid, checked again
+ * every few seconds for devices plugged in later, and their rawmidi ports
+ * are read through a single epoll set. Each device gets a cable number,
+ * the lowest one free, which replaces the MIDI channel of its messages
+ * (-t none leaves them as they are).
+ *
+ * All events are timestamped on one sequencer queue that runs in real
+ * time from the start of the daemon. Where the kernel supports it
+ * (SND_RAWMIDI_READ_TSTAMP, Linux 5.14) the time is when the USB driver
+ * received the message, otherwise when it was read.
+ *
+ * Ports given with -p are opened in addition, so it can be tried out with
+ * virtual rawmidi ports (snd-virmidi) fed by host/midifoot-virtual, see
+ * the README.
+ *
+ * Build with "make tools/mfmerge" (needs the ALSA headers, libasound2-dev).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <alsa/asoundlib.h>
+
+#define VID 0x16c0
+#define PID 0x05e4
+#define DEVICES_MAX 16          // one per MIDI channel
+#define RESCAN_MS 2000
+
+typedef struct
+{
+    char port[32];              // hw:N,0
+    int card;                   // -1 for ports given with -p
+    snd_rawmidi_t *in;
+    int fd;
+    int stamped;                // kernel timestamps
+    snd_midi_event_t *encoder;
+    long events;
+} device_t;
+
+device_t *devices[DEVICES_MAX]; // indexed by cable number
+int epfd;
+snd_seq_t *seq;
+int seqPort, seqQueue;
+int64_t startNs;                // CLOCK_MONOTONIC when the queue started
+int tagChannel = 1;
+int verbose = 0;
+volatile sig_atomic_t stop = 0;
+
+int64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int deviceOpen(const char *port, int card)
+{
+    int cable = 0;
+    while (cable < DEVICES_MAX && devices[cable]) cable++;
+    if (cable == DEVICES_MAX)
+    {
+        fprintf(stderr, "mfmerge: %s: no cable left\n", port);
+        return -1;
+    }
+    device_t *d = calloc(1, sizeof(device_t));
+    snprintf(d->port, sizeof(d->port), "%s", port);
+    d->card = card;
+    int err = snd_rawmidi_open(&d->in, NULL, port, SND_RAWMIDI_NONBLOCK);
+    if (err < 0)
+    {
+        fprintf(stderr, "mfmerge: %s: %s\n", port, snd_strerror(err));
+        free(d);
+        return -1;
+    }
+    snd_rawmidi_params_t *params;
+    snd_rawmidi_params_alloca(&params);
+    snd_rawmidi_params_current(d->in, params);
+    snd_rawmidi_params_set_read_mode(d->in, params, SND_RAWMIDI_READ_TSTAMP);
+    snd_rawmidi_params_set_clock_type(d->in, params, SND_RAWMIDI_CLOCK_MONOTONIC);
+    d->stamped = snd_rawmidi_params(d->in, params) == 0;
+    struct pollfd pfd;
+    snd_rawmidi_poll_descriptors(d->in, &pfd, 1);
+    d->fd = pfd.fd;
+    snd_midi_event_new(16, &d->encoder);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = cable};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, d->fd, &ev);
+    devices[cable] = d;
+    fprintf(stderr, "mfmerge: %s is cable %d%s\n", port, cable,
+        d->stamped ? "" : ", without kernel timestamps");
+    return 0;
+}
+
+void deviceClose(int cable)
+{
+    device_t *d = devices[cable];
+    fprintf(stderr, "mfmerge: %s gone, %ld events\n", d->port, d->events);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, NULL);
+    snd_rawmidi_close(d->in);
+    snd_midi_event_free(d->encoder);
+    free(d);
+    devices[cable] = NULL;
+}
+
+// open MidiFoots that aren't open yet
+void scan(void)
+{
+    int card = -1;
+    while (snd_card_next(&card) == 0 && card >= 0)
+    {
+        char path[64];
+        unsigned vid, pid;
+        snprintf(path, sizeof(path), "/proc/asound/card%d/usbid", card);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        int match = fscanf(f, "%x:%x", &vid, &pid) == 2 && vid == VID && pid == PID;
+        fclose(f);
+        if (!match) continue;
+        int open = 0;
+        for (int i = 0; i < DEVICES_MAX; i++) open |= devices[i] && devices[i]->card == card;
+        if (open) continue;
+        char port[32];
+        snprintf(port, sizeof(port), "hw:%d,0", card);
+        deviceOpen(port, card);
+    }
+}
+
+void deviceRead(int cable)
+{
+    device_t *d = devices[cable];
+    for (;;)
+    {
+        uint8_t buf[64];
+        struct timespec ts;
+        ssize_t n = d->stamped ? snd_rawmidi_tread(d->in, &ts, buf, sizeof(buf))
+                               : snd_rawmidi_read(d->in, buf, sizeof(buf));
+        if (n == -EAGAIN) return;
+        if (n < 0)              // unplugged
+        {
+            deviceClose(cable);
+            return;
+        }
+        int64_t t = d->stamped ? ts.tv_sec * 1000000000LL + ts.tv_nsec : monotonicNs();
+        t -= startNs;
+        if (t < 0) t = 0;
+        snd_seq_real_time_t rt = {t / 1000000000, t % 1000000000};
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t b = buf[i];
+            if (tagChannel && b >= 0x80 && b < 0xf0) b = (b & 0xf0) | cable;
+            snd_seq_event_t ev;
+            snd_seq_ev_clear(&ev);  // the encoder only fills in the message
+            if (snd_midi_event_encode_byte(d->encoder, b, &ev) != 1) continue;
+            snd_seq_ev_set_source(&ev, seqPort);
+            snd_seq_ev_set_subs(&ev);
+            snd_seq_ev_schedule_real(&ev, seqQueue, 0, &rt);
+            snd_seq_event_output_direct(seq, &ev);
+            d->events++;
+            if (verbose)
+            {
+                printf("%10.6f  cable %2d  type %3d\n", t / 1e9, cable, ev.type);
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+void onSignal(int sig)
+{
+    stop = 1;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "usage: mfmerge [-n name] [-p port]... [-t channel|none] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = "MidiFoot Merge";
+    const char *ports[DEVICES_MAX];
+    int portCount = 0;
+    int c;
+    while ((c = getopt(argc, argv, "n:p:t:v")) != -1)
+    {
+        switch (c)
+        {
+        case 'n': name = optarg; break;
+        case 'p':
+            if (portCount == DEVICES_MAX) usage();
+            ports[portCount++] = optarg;
+            break;
+        case 't':
+            if (!strcmp(optarg, "none")) tagChannel = 0;
+            else if (strcmp(optarg, "channel")) usage();
+            break;
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0)
+    {
+        fprintf(stderr, "mfmerge: can't open the ALSA sequencer\n");
+        return 2;
+    }
+    snd_seq_set_client_name(seq, name);
+    seqPort = snd_seq_create_simple_port(seq, "MidiFoots",
+        SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+        SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    seqQueue = snd_seq_alloc_named_queue(seq, name);
+    snd_seq_start_queue(seq, seqQueue, NULL);
+    snd_seq_drain_output(seq);
+    startNs = monotonicNs();
+    printf("sequencer port %d:%d\n", snd_seq_client_id(seq), seqPort);
+    fflush(stdout);
+
+    epfd = epoll_create1(0);
+    for (int i = 0; i < portCount; i++) deviceOpen(ports[i], -1);
+    scan();
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    int64_t nextScan = monotonicNs() + RESCAN_MS * 1000000LL;
+    while (!stop)
+    {
+        struct epoll_event ready[DEVICES_MAX];
+        int n = epoll_wait(epfd, ready, DEVICES_MAX, RESCAN_MS);
+        for (int i = 0; i < n; i++)
+        {
+            if (devices[ready[i].data.u32]) deviceRead(ready[i].data.u32);
+        }
+        if (monotonicNs() >= nextScan)
+        {
+            scan();
+            nextScan = monotonicNs() + RESCAN_MS * 1000000LL;
+        }
+    }
+    for (int i = 0; i < DEVICES_MAX; i++)
+    {
+        if (devices[i]) deviceClose(i);
+    }
+    snd_seq_close(seq);
+    return 0;
+}
@@ -11,6 +11,8 @@
 #ifndef __usbconfig_h_included__
 #define __usbconfig_h_included__
 
+#include "midifootconfig.h"
+
 /* ---------------------------- Hardware Config ---------------------------- */
 
 #define USB_CFG_IOPORTNAME      B
@@ -116,21 +118,25 @@
  * transfers. Set it to 0 if you don't need it and want to save a couple of
  * bytes.
  */
-#define USB_CFG_IMPLEMENT_FN_READ       0
+#define USB_CFG_IMPLEMENT_FN_READ       MIDIFOOT_TRACE
 /* Set this to 1 if you need to send control replies which are generated
  * "on the fly" when usbFunctionRead() is called. If you only want to send
  * data from a static buffer, set it to 0 and return the data from
  * usbFunctionSetup(). This saves a couple of bytes.
+ * The trace buffer is read this way, since it wraps around.
  */
-#define USB_CFG_IMPLEMENT_FN_WRITEOUT   0
+#define USB_CFG_IMPLEMENT_FN_WRITEOUT   (MIDIFOOT_DIN_THRU || MIDIFOOT_LEDS)
 /* Define this to 1 if you want to use interrupt-out (or bulk out) endpoint 1.
  * You must implement the function usbFunctionWriteOut() which receives all
  * interrupt/bulk data sent to endpoint 1.
+ * The MIDI OUT endpoint, only read when it is forwarded to the DIN output or
+ * drives the LED.
  */
-#define USB_CFG_HAVE_FLOWCONTROL        0
+#define USB_CFG_HAVE_FLOWCONTROL        MIDIFOOT_DIN_THRU
 /* Define this to 1 if you want flowcontrol over USB data. See the definition
  * of the macros usbDisableAllRequests() and usbEnableAllRequests() in
  * usbdrv.h.
+ * The host is held off while the DIN queue is full.
  */
 #define USB_CFG_DRIVER_FLASH_PAGE       0
 /* If the device has more than 64 kBytes of flash, define this to the 64 k page
@@ -154,6 +160,35 @@
  * one parameter which distinguishes between the start of RESET state and its
  * end.
  */
+#ifndef __ASSEMBLER__
+extern void usbSetupHook(unsigned char *data);
+extern void usbResetHook(void);
+#endif
+#if MIDIFOOT_REMOTE_WAKEUP
+#define USB_RX_USER_HOOK(data, len)     if(usbRxToken == (uchar)USBPID_SETUP) usbSetupHook(data);
+#endif
+#if MIDIFOOT_REMOTE_WAKEUP || MIDIFOOT_HEALTH
+#define USB_RESET_HOOK(resetStarts)     if(resetStarts) usbResetHook();
+#endif
+/* The driver handles standard requests itself, so midifoot.c watches setup
+ * packets for SET_FEATURE/CLEAR_FEATURE(DEVICE_REMOTE_WAKEUP). A bus reset
+ * disables remote wakeup again and is counted by the health counters.
+ */
+#if MIDIFOOT_TRACE
+#ifndef __ASSEMBLER__
+extern void traceWrite(unsigned char id, unsigned char *data, unsigned char len);
+#endif
+#define DBG1(prefix, data, len)         traceWrite(prefix, (unsigned char *)(data), len)
+#if MIDIFOOT_TRACE > 1
+#define DBG2(prefix, data, len)         traceWrite(prefix, (unsigned char *)(data), len)
+#else
+#define DBG2(prefix, data, len)
+#endif
+#endif
+/* The driver's debug output goes to the trace buffer in midifoot.c instead
+ * of the UART that oddebug.c expects. All DBG calls in usbdrv.c are made
+ * from usbPoll() or usbInit(), never from the interrupt.
+ */
 /* #define USB_SET_ADDRESS_HOOK()              hadAddressAssigned(); */
 /* This macro (if defined) is executed when a USB SET_ADDRESS request was
  * received.
@@ -337,7 +372,8 @@
 #define USB_CFG_DESCR_PROPS_STRING_0                0
 #define USB_CFG_DESCR_PROPS_STRING_VENDOR           0
 #define USB_CFG_DESCR_PROPS_STRING_PRODUCT          0
-#define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    0
+#define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    (MIDIFOOT_SERIAL ? USB_PROP_IS_DYNAMIC | USB_PROP_IS_RAM : 0)
+/* built from EEPROM at startup, see MIDIFOOT_SERIAL in midifootconfig.h */
 #define USB_CFG_DESCR_PROPS_HID                     0	// USB_PROP_IS_DYNAMIC
 #define USB_CFG_DESCR_PROPS_HID_REPORT              0
 #define USB_CFG_DESCR_PROPS_UNKNOWN                 0
@@ -45,17 +45,22 @@ the output and a memory block to dump in hex ('data' and 'len').
 
 /* ------------------------------------------------------------------------- */
 
+/* DBG1 and DBG2 may be redirected by usbconfig.h */
+#ifndef DBG1
 #if DEBUG_LEVEL > 0
 #   define  DBG1(prefix, data, len) odDebug(prefix, data, len)
 #else
 #   define  DBG1(prefix, data, len)
 #endif
+#endif
 
+#ifndef DBG2
 #if DEBUG_LEVEL > 1
 #   define  DBG2(prefix, data, len) odDebug(prefix, data, len)
 #else
 #   define  DBG2(prefix, data, len)
 #endif
+#endif
 
 /* ------------------------------------------------------------------------- */
 